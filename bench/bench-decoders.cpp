@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "canned-bitstreams.hpp"
+#include "synthetic-source.hpp"
+
+#include <benchmark/benchmark.h>
+#include <vpx/vpx_decoder.h>
+#include <vpx/vp8dx.h>
+#include <wels/codec_api.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Decoding of canned bitstreams as received from the encoders under test.
+// The bitstreams are produced once per size before timing from a moving
+// pattern; the first frame is a key frame so that they can be replayed in a loop.
+// Their bitrate of 0.1 bits per pixel at 30 fps scales with the resolution,
+// e.g., about 6 Mbps at 1080p, and frames are not limited to a datagram.
+#define FRAME_SIZES ArgNames({"width", "height"})->Args({640, 480})->Args({1920, 1080})->Args({3840, 2160})
+
+constexpr uint32_t CANNED_FRAMES{30};
+
+static uint32_t decodeBitrateKbps(uint32_t width, uint32_t height) {
+  return width * height * 30 / 10 / 1000;
+}
+
+static void BM_VPxDecode(benchmark::State &state, const char *fourcc, vpx_codec_iface_t *decoderIface) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  const auto frames{ffe::cannedBitstream(fourcc, W, H, CANNED_FRAMES, ffe::SyntheticSource{ffe::SyntheticSource::Pattern::MOVING}, decodeBitrateKbps(W, H))};
+  vpx_codec_ctx_t codec;
+  if (frames.empty() || vpx_codec_dec_init(&codec, decoderIface, nullptr, 0)) {
+    state.SkipWithError("Failed to prepare VPx bitstream.");
+    return;
+  }
+  std::size_t i{0}, bytes{0};
+  for (auto _ : state) {
+    const std::string &frame{frames[i++ % frames.size()]};
+    bytes += frame.size();
+    if (!vpx_codec_decode(&codec, reinterpret_cast<const uint8_t*>(frame.data()), static_cast<unsigned int>(frame.size()), nullptr, 0)) {
+      vpx_codec_iter_t it{nullptr};
+      while (nullptr != vpx_codec_get_frame(&codec, &it)) {}
+    }
+  }
+  vpx_codec_destroy(&codec);
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK_CAPTURE(BM_VPxDecode, VP80, "VP80", &vpx_codec_vp8_dx_algo)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_VPxDecode, VP90, "VP90", &vpx_codec_vp9_dx_algo)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+static void BM_H264Decode(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  const auto frames{ffe::cannedBitstream("h264", W, H, CANNED_FRAMES, ffe::SyntheticSource{ffe::SyntheticSource::Pattern::MOVING}, decodeBitrateKbps(W, H))};
+  ISVCDecoder *decoder{nullptr};
+  if (frames.empty() || (0 != WelsCreateDecoder(&decoder)) || (nullptr == decoder)) {
+    state.SkipWithError("Failed to prepare h264 bitstream.");
+    return;
+  }
+  SDecodingParam decodingParam;
+  std::memset(&decodingParam, 0, sizeof(SDecodingParam));
+  decodingParam.eEcActiveIdc = ERROR_CON_DISABLE;
+  decodingParam.bParseOnly = false;
+  decodingParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_DEFAULT;
+  decoder->Initialize(&decodingParam);
+  std::size_t i{0}, bytes{0};
+  for (auto _ : state) {
+    const std::string &frame{frames[i++ % frames.size()]};
+    bytes += frame.size();
+    uint8_t *yuvData[3];
+    SBufferInfo bufferInfo;
+    std::memset(&bufferInfo, 0, sizeof(SBufferInfo));
+    benchmark::DoNotOptimize(decoder->DecodeFrame2(reinterpret_cast<const unsigned char*>(frame.data()), static_cast<int>(frame.size()), yuvData, &bufferInfo));
+  }
+  decoder->Uninitialize();
+  WelsDestroyDecoder(decoder);
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+}
+BENCHMARK(BM_H264Decode)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lodepng.h"
+#include "frame-reader.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Reading a folder of 1080p PNG files as the ingest stage does, with pread or
+// io_uring at different read-ahead depths. The files are created once in the
+// folder given by FFE_BENCH_DIR (default: current folder) as tmpfs would
+// neither support O_DIRECT nor a cold page cache; for cold runs, the files
+// are evicted from the page cache before every iteration.
+constexpr uint32_t INGEST_FILES{32};
+
+class IngestCorpus {
+ private:
+  IngestCorpus(const IngestCorpus &) = delete;
+  IngestCorpus(IngestCorpus &&)      = delete;
+  IngestCorpus &operator=(const IngestCorpus &) = delete;
+  IngestCorpus &operator=(IngestCorpus &&) = delete;
+
+ public:
+  IngestCorpus() noexcept
+    : m_folder()
+    , m_files() {
+    const char *dir{std::getenv("FFE_BENCH_DIR")};
+    std::string folder{(nullptr != dir) ? dir : "."};
+    folder += "/ffe-bench-ingest-XXXXXX";
+    if (nullptr == ::mkdtemp(&folder[0])) {
+      return;
+    }
+    m_folder = folder;
+
+    const uint32_t W{1920}, H{1080};
+    std::vector<unsigned char> rgba(W * H * 4);
+    uint32_t state{0x12345678};
+    for (std::size_t i{0}; i < rgba.size(); i++) {
+      state = state * 1664525u + 1013904223u;
+      rgba[i] = ((i % 4) == 3) ? 0xff : static_cast<unsigned char>((i / 4 % W) ^ ((state >> 24) & 0x3f));
+    }
+    std::vector<unsigned char> png;
+    lodepng::encode(png, rgba, W, H);
+    for (uint32_t i{0}; i < INGEST_FILES; i++) {
+      const std::string FILENAME{m_folder + "/" + std::to_string(i) + ".png"};
+      const int fd{::open(FILENAME.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+      if (0 > fd) {
+        continue;
+      }
+      // Written back right away so that evicting the pages works for cold runs.
+      const bool OK{(static_cast<ssize_t>(png.size()) == ::write(fd, png.data(), png.size())) && (0 == ::fsync(fd))};
+      ::close(fd);
+      if (OK) {
+        m_files.push_back(FILENAME);
+      }
+    }
+  }
+
+  ~IngestCorpus() noexcept {
+    for (const auto &file : m_files) {
+      std::remove(file.c_str());
+    }
+    if (!m_folder.empty()) {
+      ::rmdir(m_folder.c_str());
+    }
+  }
+
+  const std::vector<std::string> &files() const noexcept {
+    return m_files;
+  }
+
+  void evict() const noexcept {
+    for (const auto &file : m_files) {
+      const int fd{::open(file.c_str(), O_RDONLY | O_CLOEXEC)};
+      if (0 <= fd) {
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+      }
+    }
+  }
+
+ private:
+  std::string m_folder;
+  std::vector<std::string> m_files;
+};
+
+static const IngestCorpus &ingestCorpus() {
+  static IngestCorpus corpus;
+  return corpus;
+}
+
+static void BM_FrameIngest(benchmark::State &state, bool useIoUring, bool cold) {
+  const uint32_t DEPTH{static_cast<uint32_t>(state.range(0))};
+  const bool DIRECT{0 != state.range(1)};
+  const IngestCorpus &corpus{ingestCorpus()};
+  if (corpus.files().empty()) {
+    state.SkipWithError("Failed to create PNG files.");
+    return;
+  }
+  ffe::FrameReader reader{DEPTH, useIoUring, DIRECT};
+  if (useIoUring && (std::string{"io_uring"} != reader.backend())) {
+    state.SkipWithError("io_uring unavailable.");
+    return;
+  }
+  std::size_t bytes{0};
+  for (auto _ : state) {
+    if (cold) {
+      state.PauseTiming();
+      corpus.evict();
+      state.ResumeTiming();
+    }
+    std::size_t next{0};
+    while ((next < corpus.files().size()) || (0 < reader.pending())) {
+      while ((next < corpus.files().size()) && reader.submit(corpus.files()[next])) {
+        next++;
+      }
+      const unsigned char *data{nullptr};
+      std::size_t size{0};
+      if (0 == reader.next(data, size)) {
+        benchmark::DoNotOptimize(data[size - 1]);
+        bytes += size;
+      }
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(bytes));
+  state.SetLabel(reader.backend());
+}
+#define INGEST_ARGS ArgNames({"depth", "direct"})->Args({1, 0})->Args({8, 0})->Args({8, 1})->Unit(benchmark::kMillisecond)->UseRealTime()
+BENCHMARK_CAPTURE(BM_FrameIngest, pread_warm, false, false)->INGEST_ARGS;
+BENCHMARK_CAPTURE(BM_FrameIngest, pread_cold, false, true)->INGEST_ARGS;
+BENCHMARK_CAPTURE(BM_FrameIngest, io_uring_warm, true, false)->INGEST_ARGS;
+BENCHMARK_CAPTURE(BM_FrameIngest, io_uring_cold, true, true)->INGEST_ARGS;
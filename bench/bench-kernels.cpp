@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lodepng.h"
+#include "difference-map.hpp"
+#include "frame-metrics.hpp"
+#include "frame-buffer-pool.hpp"
+#include "png-decoder.hpp"
+
+#include <benchmark/benchmark.h>
+#include <libyuv.h>
+
+#include <cstdint>
+#include <vector>
+
+// Per-frame kernels of the evaluator at 640x480, 1080p, and 4K.
+#define FRAME_SIZES ArgNames({"width", "height"})->Args({640, 480})->Args({1920, 1080})->Args({3840, 2160})
+
+// Synthetic RGBA content: gradients with a little noise so that PNG and the
+// metrics do not hit trivial paths.
+static std::vector<unsigned char> syntheticRGBA(uint32_t width, uint32_t height) {
+  std::vector<unsigned char> rgba(width * height * 4);
+  uint32_t state{0x12345678};
+  for (uint32_t y{0}; y < height; y++) {
+    for (uint32_t x{0}; x < width; x++) {
+      state = state * 1664525u + 1013904223u;
+      const uint8_t noise{static_cast<uint8_t>((state >> 24) & 0x0f)};
+      unsigned char *p{&rgba[(y * width + x) * 4]};
+      p[0] = static_cast<unsigned char>((x * 255 / width) ^ noise);
+      p[1] = static_cast<unsigned char>((y * 255 / height) ^ noise);
+      p[2] = static_cast<unsigned char>(((x + y) & 0xff) ^ noise);
+      p[3] = 0xff;
+    }
+  }
+  return rgba;
+}
+
+static void toI420(const std::vector<unsigned char> &rgba, uint32_t width, uint32_t height, const ffe::FrameBuffer &i420) {
+  libyuv::ABGRToI420(rgba.data(), static_cast<int>(width * 4),
+                     i420.y(), i420.strides[0], i420.u(), i420.strides[1], i420.v(), i420.strides[2],
+                     static_cast<int>(width), static_cast<int>(height));
+}
+
+static void BM_LodePNGDecode(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  std::vector<unsigned char> png;
+  lodepng::encode(png, syntheticRGBA(W, H), W, H);
+  std::vector<unsigned char> rgba;
+  for (auto _ : state) {
+    rgba.clear();
+    unsigned w{0}, h{0};
+    benchmark::DoNotOptimize(lodepng::decode(rgba, w, h, png));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * W * H * 4);
+}
+BENCHMARK(BM_LodePNGDecode)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+
+// The evaluator's decode path: zlib inflate if available, optionally without
+// CRC and Adler-32 verification; compare against BM_LodePNGDecode above.
+static void BM_PngDecoder(benchmark::State &state, bool ignoreChecksums) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  std::vector<unsigned char> png;
+  lodepng::encode(png, syntheticRGBA(W, H), W, H);
+  ffe::PngDecoder decoder{ignoreChecksums};
+  state.SetLabel(decoder.inflateBackend());
+  std::vector<unsigned char> rgba;
+  for (auto _ : state) {
+    unsigned w{0}, h{0};
+    benchmark::DoNotOptimize(decoder.decode(rgba, w, h, png.data(), png.size()));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * W * H * 4);
+}
+BENCHMARK_CAPTURE(BM_PngDecoder, checked, false)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_PngDecoder, trusted, true)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+
+// Full-frame PNG to i420 as the evaluator did before streaming: decode to RGBA, then convert.
+static void BM_PngDecodeThenConvert(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  std::vector<unsigned char> png;
+  lodepng::encode(png, syntheticRGBA(W, H), W, H);
+  ffe::PngDecoder decoder{true};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 1};
+  auto i420{pool.acquire()};
+  std::vector<unsigned char> rgba;
+  for (auto _ : state) {
+    unsigned w{0}, h{0};
+    decoder.decode(rgba, w, h, png.data(), png.size());
+    toI420(rgba, W, H, *i420);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * W * H * 4);
+}
+BENCHMARK(BM_PngDecodeThenConvert)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+
+// PNG to i420 with scanlines converted in cache-sized batches while inflating;
+// gray and RGB sources are converted in their native color type.
+static void BM_PngDecodeToI420(benchmark::State &state, LodePNGColorType colortype) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  std::vector<unsigned char> png;
+  lodepng::State encoderState;
+  encoderState.encoder.auto_convert = 0;
+  encoderState.info_png.color.colortype = colortype;
+  lodepng::encode(png, syntheticRGBA(W, H), W, H, encoderState);
+  ffe::PngDecoder decoder{true};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 1};
+  auto i420{pool.acquire()};
+  for (auto _ : state) {
+    unsigned w{0}, h{0};
+    decoder.load(png.data(), png.size(), w, h);
+    benchmark::DoNotOptimize(decoder.toI420(*i420, 0, 0));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * W * H * 4);
+}
+BENCHMARK_CAPTURE(BM_PngDecodeToI420, rgba, LCT_RGBA)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_PngDecodeToI420, rgb, LCT_RGB)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_PngDecodeToI420, grey, LCT_GREY)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+
+static void BM_ABGRToI420(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  const auto rgba{syntheticRGBA(W, H)};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 1};
+  auto i420{pool.acquire()};
+  for (auto _ : state) {
+    toI420(rgba, W, H, *i420);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * W * H * 4);
+}
+BENCHMARK(BM_ABGRToI420)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+// Cropping the centered quarter from a tightly packed i420 frame as the evaluator originally did.
+static void BM_ConvertToI420Crop(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  const uint32_t CW{W / 2}, CH{H / 2};
+  std::vector<uint8_t> src(W * H * 3 / 2, 0x80);
+  std::vector<uint8_t> dst(CW * CH * 3 / 2);
+  for (auto _ : state) {
+    libyuv::ConvertToI420(src.data(), src.size(),
+                          dst.data(), static_cast<int>(CW),
+                          dst.data() + CW * CH, static_cast<int>(CW / 2),
+                          dst.data() + CW * CH + CW * CH / 4, static_cast<int>(CW / 2),
+                          static_cast<int>(W / 4), static_cast<int>(H / 4),
+                          static_cast<int>(W), static_cast<int>(H),
+                          static_cast<int>(CW), static_cast<int>(CH),
+                          libyuv::kRotate0, FOURCC('I', '4', '2', '0'));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * dst.size());
+}
+BENCHMARK(BM_ConvertToI420Crop)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+static void BM_I420Copy(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 2};
+  auto src{pool.acquire()};
+  auto dst{pool.acquire()};
+  toI420(syntheticRGBA(W, H), W, H, *src);
+  for (auto _ : state) {
+    libyuv::I420Copy(src->y(), src->strides[0], src->u(), src->strides[1], src->v(), src->strides[2],
+                     dst->y(), dst->strides[0], dst->u(), dst->strides[1], dst->v(), dst->strides[2],
+                     static_cast<int>(W), static_cast<int>(H));
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * W * H * 3 / 2);
+}
+BENCHMARK(BM_I420Copy)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+// Source and a slightly distorted copy for the metrics.
+static void distortedPair(uint32_t W, uint32_t H, const ffe::FrameBuffer &a, const ffe::FrameBuffer &b) {
+  auto rgba{syntheticRGBA(W, H)};
+  toI420(rgba, W, H, a);
+  for (std::size_t i{0}; i < rgba.size(); i += 7) {
+    rgba[i] = static_cast<unsigned char>(rgba[i] + 3);
+  }
+  toI420(rgba, W, H, b);
+}
+
+static void BM_I420Psnr(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 2};
+  auto a{pool.acquire()};
+  auto b{pool.acquire()};
+  distortedPair(W, H, *a, *b);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(libyuv::I420Psnr(a->y(), a->strides[0], a->u(), a->strides[1], a->v(), a->strides[2],
+                                              b->y(), b->strides[0], b->u(), b->strides[1], b->v(), b->strides[2],
+                                              static_cast<int>(W), static_cast<int>(H)));
+  }
+}
+BENCHMARK(BM_I420Psnr)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+static void BM_I420Ssim(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 2};
+  auto a{pool.acquire()};
+  auto b{pool.acquire()};
+  distortedPair(W, H, *a, *b);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(libyuv::I420Ssim(a->y(), a->strides[0], a->u(), a->strides[1], a->v(), a->strides[2],
+                                              b->y(), b->strides[0], b->u(), b->strides[1], b->v(), b->strides[2],
+                                              static_cast<int>(W), static_cast<int>(H)));
+  }
+}
+BENCHMARK(BM_I420Ssim)->FRAME_SIZES->Unit(benchmark::kMillisecond);
+
+// PSNR, SSIM, and MSE per plane in one pass as the evaluator computes them;
+// compare against BM_I420Psnr plus BM_I420Ssim above. MS-SSIM alone, with
+// temporal metrics (the pair swapped as previous frames), and all metrics on
+// 4 threads (--metrics.threads).
+static void BM_FrameMetrics(benchmark::State &state, uint32_t metrics, uint32_t threads) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 2};
+  auto a{pool.acquire()};
+  auto b{pool.acquire()};
+  distortedPair(W, H, *a, *b);
+  ffe::WorkerPool workers{threads, ffe::ThreadPlacement{}};
+  ffe::FrameMetrics frameMetrics{metrics, &workers};
+  for (auto _ : state) {
+    frameMetrics.compute(*a, *b, W, H, b.get(), a.get());
+    benchmark::DoNotOptimize(frameMetrics.ssim());
+  }
+}
+BENCHMARK_CAPTURE(BM_FrameMetrics, psnr_ssim, ffe::FrameMetrics::METRIC_PSNR | ffe::FrameMetrics::METRIC_SSIM, 1)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_FrameMetrics, msssim, ffe::FrameMetrics::METRIC_MSSSIM, 1)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_FrameMetrics, psnr_ssim_temporal, ffe::FrameMetrics::METRIC_PSNR | ffe::FrameMetrics::METRIC_SSIM | ffe::FrameMetrics::METRIC_TEMPORAL, 1)
+    ->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_FrameMetrics, all_4threads, ffe::FrameMetrics::METRIC_PSNR | ffe::FrameMetrics::METRIC_SSIM | ffe::FrameMetrics::METRIC_MSSSIM |
+                  ffe::FrameMetrics::METRIC_TEMPORAL, 4)
+    ->FRAME_SIZES->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+// Shortcuts of FrameMetrics (enabled by default; --nofastpath): changing
+// results cost one hash of the result on top of BM_FrameMetrics/psnr_ssim,
+// a repeated pair costs the hashes of result and source, and a result equal
+// to its source one comparison.
+static void BM_FrameMetricsShortcut(benchmark::State &state, ffe::FrameMetrics::Shortcut shortcut) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 3};
+  auto a{pool.acquire()};
+  auto b{pool.acquire()};
+  auto c{pool.acquire()};
+  distortedPair(W, H, *a, *b);
+  distortedPair(W, H, *a, *c);
+  c->y()[0] ^= 1;
+  ffe::FrameMetrics frameMetrics{ffe::FrameMetrics::METRIC_PSNR | ffe::FrameMetrics::METRIC_SSIM, nullptr, true};
+  bool odd{false};
+  for (auto _ : state) {
+    const ffe::FrameBuffer &RESULT{(ffe::FrameMetrics::Shortcut::IDENTICAL == shortcut) ? *a :
+                                   ((ffe::FrameMetrics::Shortcut::NONE == shortcut) && odd) ? *c : *b};
+    frameMetrics.compute(*a, RESULT, W, H);
+    benchmark::DoNotOptimize(frameMetrics.ssim());
+    odd = !odd;
+  }
+}
+BENCHMARK_CAPTURE(BM_FrameMetricsShortcut, none, ffe::FrameMetrics::Shortcut::NONE)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_FrameMetricsShortcut, repeated, ffe::FrameMetrics::Shortcut::REPEATED)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_FrameMetricsShortcut, identical, ffe::FrameMetrics::Shortcut::IDENTICAL)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+// Heatmap of the preview; rendered on the preview thread at a limited rate.
+static void BM_DifferenceMap(benchmark::State &state, ffe::DifferenceMap::Mode mode) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool pool{ffe::PixelFormat::I420, W, H, 2};
+  ffe::FrameBufferPool argbPool{ffe::PixelFormat::ARGB, W, H, 1};
+  auto a{pool.acquire()};
+  auto b{pool.acquire()};
+  auto argb{argbPool.acquire()};
+  distortedPair(W, H, *a, *b);
+  ffe::DifferenceMap map{mode, W, H};
+  for (auto _ : state) {
+    map.render(*a, *b, argb->data(), argb->stride());
+    benchmark::DoNotOptimize(argb->data()[0]);
+  }
+}
+BENCHMARK_CAPTURE(BM_DifferenceMap, absdiff, ffe::DifferenceMap::Mode::ABSDIFF)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_DifferenceMap, ssim, ffe::DifferenceMap::Mode::SSIM)->FRAME_SIZES->Unit(benchmark::kMicrosecond);
+
+// Storing a decoded frame as the evaluator does with --savepng, without the file I/O.
+static void BM_I420ToABGRAndPNGEncode(benchmark::State &state) {
+  const uint32_t W{static_cast<uint32_t>(state.range(0))}, H{static_cast<uint32_t>(state.range(1))};
+  ffe::FrameBufferPool i420Pool{ffe::PixelFormat::I420, W, H, 1};
+  ffe::FrameBufferPool abgrPool{ffe::PixelFormat::ARGB, W, H, 1, false, 1};
+  auto i420{i420Pool.acquire()};
+  auto abgr{abgrPool.acquire()};
+  toI420(syntheticRGBA(W, H), W, H, *i420);
+  std::vector<unsigned char> png;
+  for (auto _ : state) {
+    libyuv::I420ToABGR(i420->y(), i420->strides[0], i420->u(), i420->strides[1], i420->v(), i420->strides[2],
+                       abgr->data(), abgr->stride(), static_cast<int>(W), static_cast<int>(H));
+    png.clear();
+    benchmark::DoNotOptimize(lodepng::encode(png, abgr->data(), W, H));
+  }
+}
+BENCHMARK(BM_I420ToABGRAndPNGEncode)->FRAME_SIZES->Unit(benchmark::kMillisecond);
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cluon-complete.hpp"
+#include "shared-memory-tuning.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Publishing one i420 frame into the shared memory: lock, copy, time stamp,
+// unlock, and notify; state.range(2) selects huge pages + prefault.
+static void BM_SharedMemoryPublish(benchmark::State &state) {
+  const uint32_t WIDTH{static_cast<uint32_t>(state.range(0))};
+  const uint32_t HEIGHT{static_cast<uint32_t>(state.range(1))};
+  const bool TUNED{0 != state.range(2)};
+  const uint32_t SIZE{WIDTH * HEIGHT * 3/2};
+
+  static uint32_t counter{0};
+  const std::string NAME{"ffe-bench-" + std::to_string(::getpid()) + "-" + std::to_string(counter++)};
+  std::unique_ptr<cluon::SharedMemory> sharedMemory{new cluon::SharedMemory{NAME, SIZE}};
+  if (!sharedMemory->valid()) {
+    state.SkipWithError("Failed to create shared memory.");
+    return;
+  }
+  if (TUNED) {
+    ffe::SharedMemoryTuning tuning;
+    tuning.hugePages = true;
+    tuning.prefault = true;
+    auto applied = ffe::tuneSharedMemory(sharedMemory->data(), sharedMemory->size(), tuning);
+    state.counters["hugepages"] = applied.hugePages ? 1 : 0;
+  }
+
+  std::vector<char> frame(SIZE, 0x55);
+  for (auto _ : state) {
+    sharedMemory->lock();
+    std::memcpy(sharedMemory->data(), frame.data(), SIZE);
+    sharedMemory->setTimeStamp(cluon::time::now());
+    sharedMemory->unlock();
+    sharedMemory->notifyAll();
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * SIZE);
+}
+BENCHMARK(BM_SharedMemoryPublish)
+  ->ArgNames({"width", "height", "tuned"})
+  ->Args({1920, 1080, 0})->Args({1920, 1080, 1})
+  ->Args({3840, 2160, 0})->Args({3840, 2160, 1})
+  ->Args({7680, 4320, 0})->Args({7680, 4320, 1});
+
+// Only notifying the shared condition, i.e., the cost per frame without the copy.
+static void BM_SharedMemoryNotify(benchmark::State &state) {
+  const std::string NAME{"ffe-bench-notify-" + std::to_string(::getpid())};
+  cluon::SharedMemory sharedMemory{NAME, 4096};
+  for (auto _ : state) {
+    sharedMemory.notifyAll();
+  }
+}
+BENCHMARK(BM_SharedMemoryNotify);
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CANNED_BITSTREAMS_HPP
+#define CANNED_BITSTREAMS_HPP
+
+#include "frame-buffer-pool.hpp"
+#include "synthetic-source.hpp"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+#include <wels/codec_api.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * This function encodes a synthetic sequence once so that it can be
+ * replayed as if it came from an encoder under test. The first frame is a
+ * key frame; hence, the sequence can be decoded in a loop.
+ *
+ * @param fourcc Codec as used in ImageReading (VP80, VP90, h264).
+ * @param width Width of the frames.
+ * @param height Height of the frames.
+ * @param count Number of frames to encode.
+ * @param source Content to encode.
+ * @param bitrateKbps Target bitrate at 30 fps; 0 for width * height / 800.
+ * @param maxFrameSize Limit of every frame in bytes, e.g., to fit into a
+ *                     datagram; key frames are capped accordingly; 0 for none.
+ * @return Encoded frames; empty if the codec is unknown or failed or a frame
+ *         exceeds maxFrameSize.
+ */
+inline std::vector<std::string> cannedBitstream(const std::string &fourcc, uint32_t width, uint32_t height, uint32_t count, const SyntheticSource &source,
+                                                uint32_t bitrateKbps = 0, std::size_t maxFrameSize = 0) noexcept {
+  std::vector<std::string> frames;
+  constexpr uint32_t FPS{30};
+  const uint32_t BITRATE_KBPS{std::max<uint32_t>(1, (0 != bitrateKbps) ? bitrateKbps : width * height / 800)};
+  FrameBufferPool pool{PixelFormat::I420, width, height, 1};
+  FrameBufferHandle i420{pool.acquire()};
+  if (!i420) {
+    return frames;
+  }
+
+  if (("VP80" == fourcc) || ("VP90" == fourcc)) {
+    vpx_codec_iface_t *iface{("VP80" == fourcc) ? &vpx_codec_vp8_cx_algo : &vpx_codec_vp9_cx_algo};
+    vpx_codec_enc_cfg_t cfg;
+    if (vpx_codec_enc_config_default(iface, &cfg, 0)) {
+      return frames;
+    }
+    cfg.g_w = width;
+    cfg.g_h = height;
+    cfg.g_timebase.num = 1;
+    cfg.g_timebase.den = FPS;
+    cfg.g_lag_in_frames = 0;
+    cfg.rc_target_bitrate = BITRATE_KBPS;
+    vpx_codec_ctx_t encoder;
+    if (vpx_codec_enc_init(&encoder, iface, &cfg, 0)) {
+      return frames;
+    }
+    if (0 < maxFrameSize) {
+      // Key frames of at most maxFrameSize, in percent of the mean frame.
+      const std::size_t MEAN_FRAME_SIZE{std::max<std::size_t>(1, BITRATE_KBPS * 1000 / 8 / FPS)};
+      vpx_codec_control(&encoder, VP8E_SET_MAX_INTRA_BITRATE_PCT, static_cast<unsigned int>(maxFrameSize * 100 / MEAN_FRAME_SIZE));
+    }
+    for (uint32_t i{0}; i < count; i++) {
+      source.render(i, *i420);
+      vpx_image_t image;
+      vpx_img_wrap(&image, VPX_IMG_FMT_I420, width, height, 1, i420->y());
+      for (uint32_t p{0}; p < 3; p++) {
+        image.planes[p] = i420->planes[p];
+        image.stride[p] = i420->strides[p];
+      }
+      if (!vpx_codec_encode(&encoder, &image, i, 1, (0 == i) ? VPX_EFLAG_FORCE_KF : 0, VPX_DL_REALTIME)) {
+        vpx_codec_iter_t it{nullptr};
+        const vpx_codec_cx_pkt_t *packet{nullptr};
+        while (nullptr != (packet = vpx_codec_get_cx_data(&encoder, &it))) {
+          if (VPX_CODEC_CX_FRAME_PKT == packet->kind) {
+            frames.emplace_back(static_cast<const char*>(packet->data.frame.buf), packet->data.frame.sz);
+          }
+        }
+      }
+    }
+    vpx_codec_destroy(&encoder);
+  } else if ("h264" == fourcc) {
+    ISVCEncoder *encoder{nullptr};
+    if ((0 != WelsCreateSVCEncoder(&encoder)) || (nullptr == encoder)) {
+      return frames;
+    }
+    SEncParamBase param;
+    std::memset(&param, 0, sizeof(SEncParamBase));
+    param.iUsageType = CAMERA_VIDEO_REAL_TIME;
+    param.fMaxFrameRate = FPS;
+    param.iPicWidth = static_cast<int>(width);
+    param.iPicHeight = static_cast<int>(height);
+    param.iTargetBitrate = static_cast<int>(BITRATE_KBPS * 1000);
+    if (0 == encoder->Initialize(&param)) {
+      for (uint32_t i{0}; i < count; i++) {
+        source.render(i, *i420);
+        SSourcePicture picture;
+        std::memset(&picture, 0, sizeof(SSourcePicture));
+        picture.iPicWidth = static_cast<int>(width);
+        picture.iPicHeight = static_cast<int>(height);
+        picture.iColorFormat = videoFormatI420;
+        for (uint32_t p{0}; p < 3; p++) {
+          picture.iStride[p] = i420->strides[p];
+          picture.pData[p] = i420->planes[p];
+        }
+        SFrameBSInfo info;
+        std::memset(&info, 0, sizeof(SFrameBSInfo));
+        if ((0 == encoder->EncodeFrame(&picture, &info)) && (videoFrameTypeSkip != info.eFrameType)) {
+          std::string frame;
+          for (int layer{0}; layer < info.iLayerNum; layer++) {
+            const SLayerBSInfo &layerInfo{info.sLayerInfo[layer]};
+            int size{0};
+            for (int nal{0}; nal < layerInfo.iNalCount; nal++) {
+              size += layerInfo.pNalLengthInByte[nal];
+            }
+            frame.append(reinterpret_cast<const char*>(layerInfo.pBsBuf), static_cast<std::size_t>(size));
+          }
+          frames.push_back(frame);
+        }
+      }
+      encoder->Uninitialize();
+    }
+    WelsDestroySVCEncoder(encoder);
+  }
+  for (const auto &frame : frames) {
+    if ((0 < maxFrameSize) && (maxFrameSize < frame.size())) {
+      frames.clear();
+      break;
+    }
+  }
+  return frames;
+}
+
+} // namespace ffe
+
+#endif
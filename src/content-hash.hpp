@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTENT_HASH_HPP
+#define CONTENT_HASH_HPP
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+namespace ffe {
+
+/**
+ * Final mix of MurmurHash3; every input bit affects every output bit.
+ */
+inline uint64_t mix64(uint64_t h) noexcept {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/**
+ * This function computes a fast, non-cryptographic 64-bit hash to identify
+ * contents, e.g., of files; four independent lanes consume 32 bytes per
+ * round so that the multiplications overlap.
+ *
+ * @param data Contents.
+ * @param size Number of bytes.
+ * @param seed Start value to derive independent hashes.
+ * @return Hash of the contents.
+ */
+inline uint64_t hash64(const void *data, std::size_t size, uint64_t seed = 0) noexcept {
+  constexpr uint64_t PRIME1{0x9e3779b185ebca87ULL};
+  constexpr uint64_t PRIME2{0xc2b2ae3d27d4eb4fULL};
+  auto round = [](uint64_t acc, uint64_t input) {
+    acc += input * PRIME2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * PRIME1;
+  };
+  const uint8_t *p{static_cast<const uint8_t*>(data)};
+  uint64_t lanes[4]{seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1};
+  std::size_t i{0};
+  for (; i + 32 <= size; i += 32) {
+    for (uint32_t lane{0}; lane < 4; lane++) {
+      uint64_t word;
+      std::memcpy(&word, p + i + lane * 8, 8);
+      lanes[lane] = round(lanes[lane], word);
+    }
+  }
+  uint64_t h{mix64(lanes[0]) ^ (mix64(lanes[1]) * PRIME1) ^ (mix64(lanes[2]) * PRIME2) ^ mix64(lanes[3] + size)};
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, p + i, 8);
+    h = round(h, word);
+  }
+  uint64_t tail{0};
+  if (i < size) {
+    std::memcpy(&tail, p + i, size - i);
+  }
+  return mix64(round(h, tail ^ (static_cast<uint64_t>(size - i) << 56)));
+}
+
+/**
+ * This function computes a 64-bit hash of the rows of an image plane in the
+ * style of XXH3: eight 64-bit lanes consume 64 bytes per step with one 32x32
+ * bit multiplication each, so that SSE2 handles two lanes per instruction.
+ * The keys depend on the position of the 64 bytes within a row and the lanes
+ * are scrambled after every row; hence, moved contents change the hash. The
+ * scalar code computes the same hash.
+ *
+ * @param data First row.
+ * @param stride Distance of the rows in bytes.
+ * @param width Bytes per row.
+ * @param height Number of rows.
+ * @param seed Start value to derive independent hashes.
+ * @return Hash of the rows.
+ */
+inline uint64_t hashPlane(const uint8_t *data, int32_t stride, uint32_t width, uint32_t height, uint64_t seed = 0) noexcept {
+  constexpr uint64_t PRIME1{0x9e3779b185ebca87ULL};
+  constexpr uint64_t PRIME2{0xc2b2ae3d27d4eb4fULL};
+  constexpr uint32_t PRIME32{0x9e3779b1U};
+  constexpr uint64_t KEYS[8]{0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+                             0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL};
+  // Keys of the next 64 bytes of a row.
+  constexpr uint64_t STEP{PRIME2};
+  const uint32_t STRIPES{width / 64}, TAIL{width % 64};
+  uint8_t tail[64]{};
+
+#if defined(__SSE2__)
+  __m128i acc[4]{_mm_set1_epi64x(static_cast<long long>(seed + PRIME1)), _mm_set1_epi64x(static_cast<long long>(seed + PRIME2)),
+                 _mm_set1_epi64x(static_cast<long long>(seed)), _mm_set1_epi64x(static_cast<long long>(seed - PRIME1))};
+  const __m128i STEPS{_mm_set1_epi64x(static_cast<long long>(STEP))};
+  const __m128i SCRAMBLE{_mm_set1_epi32(static_cast<int>(PRIME32))};
+  auto stripe = [&acc](const uint8_t *p, __m128i keys[4]) {
+    for (uint32_t i{0}; i < 4; i++) {
+      const __m128i D{_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i))};
+      const __m128i DK{_mm_xor_si128(D, keys[i])};
+      const __m128i PRODUCT{_mm_mul_epu32(DK, _mm_shuffle_epi32(DK, _MM_SHUFFLE(0, 3, 0, 1)))};
+      acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(PRODUCT, _mm_shuffle_epi32(D, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+  };
+  for (uint32_t y{0}; y < height; y++) {
+    const uint8_t *row{data + static_cast<std::ptrdiff_t>(y) * stride};
+    __m128i keys[4];
+    for (uint32_t i{0}; i < 4; i++) {
+      keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(KEYS + 2 * i));
+    }
+    for (uint32_t x{0}; x < STRIPES; x++) {
+      stripe(row + 64 * x, keys);
+      for (uint32_t i{0}; i < 4; i++) {
+        keys[i] = _mm_add_epi64(keys[i], STEPS);
+      }
+    }
+    if (0 < TAIL) {
+      std::memcpy(tail, row + 64 * STRIPES, TAIL);
+      stripe(tail, keys);
+    }
+    for (uint32_t i{0}; i < 4; i++) {
+      // acc = (acc ^ (acc >> 47) ^ key) * PRIME32
+      __m128i a{_mm_xor_si128(_mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(KEYS + 2 * i)))};
+      const __m128i LOW{_mm_mul_epu32(a, SCRAMBLE)};
+      const __m128i HIGH{_mm_mul_epu32(_mm_srli_epi64(a, 32), SCRAMBLE)};
+      acc[i] = _mm_add_epi64(LOW, _mm_slli_epi64(HIGH, 32));
+    }
+  }
+  uint64_t lanes[8];
+  std::memcpy(lanes, acc, sizeof(lanes));
+#else
+  uint64_t lanes[8]{seed + PRIME1, seed + PRIME1, seed + PRIME2, seed + PRIME2, seed, seed, seed - PRIME1, seed - PRIME1};
+  auto stripe = [&lanes](const uint8_t *p, const uint64_t keys[8]) {
+    uint64_t d[8];
+    std::memcpy(d, p, sizeof(d));
+    for (uint32_t i{0}; i < 8; i++) {
+      const uint64_t DK{d[i] ^ keys[i]};
+      lanes[i] += (DK & 0xffffffffULL) * (DK >> 32) + d[i ^ 1];
+    }
+  };
+  for (uint32_t y{0}; y < height; y++) {
+    const uint8_t *row{data + static_cast<std::ptrdiff_t>(y) * stride};
+    uint64_t keys[8];
+    std::memcpy(keys, KEYS, sizeof(keys));
+    for (uint32_t x{0}; x < STRIPES; x++) {
+      stripe(row + 64 * x, keys);
+      for (uint32_t i{0}; i < 8; i++) {
+        keys[i] += STEP;
+      }
+    }
+    if (0 < TAIL) {
+      std::memcpy(tail, row + 64 * STRIPES, TAIL);
+      stripe(tail, keys);
+    }
+    for (uint32_t i{0}; i < 8; i++) {
+      lanes[i] = (lanes[i] ^ (lanes[i] >> 47) ^ KEYS[i]) * PRIME32;
+    }
+  }
+#endif
+  uint64_t h{mix64(seed ^ (static_cast<uint64_t>(width) << 32 | height))};
+  for (uint32_t i{0}; i < 8; i++) {
+    h = mix64(h ^ lanes[i]) * PRIME1;
+  }
+  return mix64(h);
+}
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU_AFFINITY_HPP
+#define CPU_AFFINITY_HPP
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace ffe {
+
+/**
+ * A ThreadPlacement describes on which CPUs and with which real-time
+ * priority a group of threads shall run.
+ */
+struct ThreadPlacement {
+  bool hasCpus{false};
+  cpu_set_t cpus{};
+  int32_t priority{0}; // SCHED_FIFO priority; 0 keeps SCHED_OTHER.
+};
+
+/**
+ * This function parses a set of CPUs given either as hexadecimal mask
+ * (e.g., 0xf0) or as list of CPUs and ranges (e.g., 0-3,6).
+ *
+ * @param spec Textual representation.
+ * @param cpus Resulting CPU set.
+ * @return true if spec could be parsed and contains at least one CPU.
+ */
+inline bool parseCpuSet(const std::string &spec, cpu_set_t &cpus) noexcept {
+  CPU_ZERO(&cpus);
+  if ((2 < spec.size()) && ('0' == spec[0]) && (('x' == spec[1]) || ('X' == spec[1]))) {
+    // Hexadecimal mask, least significant digit last.
+    uint32_t cpu{0};
+    for (auto it = spec.rbegin(); it != spec.rend() - 2; it++, cpu += 4) {
+      const char c{*it};
+      uint32_t nibble{0};
+      if (('0' <= c) && ('9' >= c)) {
+        nibble = static_cast<uint32_t>(c - '0');
+      } else if (('a' <= c) && ('f' >= c)) {
+        nibble = static_cast<uint32_t>(c - 'a' + 10);
+      } else if (('A' <= c) && ('F' >= c)) {
+        nibble = static_cast<uint32_t>(c - 'A' + 10);
+      } else {
+        return false;
+      }
+      for (uint32_t bit{0}; bit < 4; bit++) {
+        if ((0 != (nibble & (1u << bit))) && (cpu + bit < CPU_SETSIZE)) {
+          CPU_SET(cpu + bit, &cpus);
+        }
+      }
+    }
+  } else {
+    std::stringstream sstr{spec};
+    std::string item;
+    while (std::getline(sstr, item, ',')) {
+      char *end{nullptr};
+      const long first{std::strtol(item.c_str(), &end, 10)};
+      long last{first};
+      if (end == item.c_str()) {
+        return false;
+      }
+      if ('-' == *end) {
+        const char *begin{end + 1};
+        last = std::strtol(begin, &end, 10);
+        if (end == begin) {
+          return false;
+        }
+      }
+      if (('\0' != *end) || (0 > first) || (last < first)) {
+        return false;
+      }
+      for (long cpu{first}; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++) {
+        CPU_SET(static_cast<int>(cpu), &cpus);
+      }
+    }
+  }
+  return 0 < CPU_COUNT(&cpus);
+}
+
+/**
+ * @return CPU set as list of CPUs and ranges (e.g., 0-3,6).
+ */
+inline std::string toString(const cpu_set_t &cpus) noexcept {
+  std::stringstream sstr;
+  int32_t cpu{0};
+  while (cpu < CPU_SETSIZE) {
+    if (CPU_ISSET(cpu, &cpus)) {
+      int32_t last{cpu};
+      while ((last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, &cpus)) {
+        last++;
+      }
+      sstr << (sstr.tellp() > 0 ? "," : "") << cpu;
+      if (last > cpu) {
+        sstr << "-" << last;
+      }
+      cpu = last + 1;
+    } else {
+      cpu++;
+    }
+  }
+  return sstr.str();
+}
+
+/**
+ * @return Description of the placement for run headers.
+ */
+inline std::string toString(const ThreadPlacement &placement) noexcept {
+  std::string str{placement.hasCpus ? toString(placement.cpus) : "any"};
+  if (0 < placement.priority) {
+    str += "@fifo" + std::to_string(placement.priority);
+  }
+  return str;
+}
+
+/**
+ * This function applies a placement to the calling thread. Threads that are
+ * created afterwards by the calling thread inherit the CPU set and the
+ * scheduling policy, which is used to place threads that are started
+ * internally by libraries (e.g., the UDPReceiver of an OD4Session).
+ *
+ * @param placement Placement to apply.
+ * @return true if all parts of the placement could be applied.
+ */
+inline bool applyToCurrentThread(const ThreadPlacement &placement) noexcept {
+  bool retVal{true};
+  if (placement.hasCpus) {
+    retVal &= (0 == ::pthread_setaffinity_np(::pthread_self(), sizeof(cpu_set_t), &placement.cpus));
+  }
+  if (0 < placement.priority) {
+    sched_param param;
+    param.sched_priority = placement.priority;
+    retVal &= (0 == ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &param));
+  }
+  return retVal;
+}
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIFFERENCE_MAP_HPP
+#define DIFFERENCE_MAP_HPP
+
+#include "frame-buffer-pool.hpp"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+  #include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A DifferenceMap renders where a decoded frame deviates from its source as
+ * a false-color ARGB heatmap: either the absolute difference per pixel or
+ * the structural dissimilarity (1 - SSIM) per 8x8 block of the luma planes.
+ */
+class DifferenceMap {
+ private:
+  DifferenceMap(const DifferenceMap &) = delete;
+  DifferenceMap(DifferenceMap &&)      = delete;
+  DifferenceMap &operator=(const DifferenceMap &) = delete;
+  DifferenceMap &operator=(DifferenceMap &&) = delete;
+
+ public:
+  enum class Mode : uint8_t {
+    OFF,
+    ABSDIFF, // |source - result| per pixel, amplified 4x.
+    SSIM,    // 1 - SSIM per 8x8 block, amplified 2x.
+  };
+
+  /**
+   * @param name Name of the mode (absdiff, ssim).
+   * @param mode Resulting mode.
+   * @return true if name denotes a known mode.
+   */
+  static bool parse(const std::string &name, Mode &mode) noexcept {
+    if ("absdiff" == name) {
+      mode = Mode::ABSDIFF;
+    } else if ("ssim" == name) {
+      mode = Mode::SSIM;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param mode What to render.
+   * @param width Width of the frames.
+   * @param height Height of the frames.
+   */
+  DifferenceMap(Mode mode, uint32_t width, uint32_t height) noexcept
+    : m_mode(mode)
+    , m_width(width)
+    , m_height(height)
+    , m_map(static_cast<std::size_t>(width) * height) {
+    // Black over blue, red, and yellow to white.
+    for (uint32_t i{0}; i < 256; i++) {
+      const uint32_t R{std::min(255u, i * 3)};
+      const uint32_t G{(i < 128) ? 0 : std::min(255u, (i - 128) * 2)};
+      const uint32_t B{(i < 64) ? i * 4 : ((i < 128) ? (127 - i) * 4 : ((i < 192) ? 0 : (i - 192) * 4))};
+      m_palette[i] = 0xff000000u | (R << 16) | (G << 8) | B;
+    }
+  }
+
+  /**
+   * This method renders the heatmap of two frames.
+   *
+   * @param source Original frame.
+   * @param result Decoded frame.
+   * @param argb Destination of the size of the frames.
+   * @param stride Stride of argb in bytes.
+   */
+  void render(const FrameBuffer &source, const FrameBuffer &result, uint8_t *argb, int32_t stride) noexcept {
+    if (Mode::ABSDIFF == m_mode) {
+      absDiff(source.y(), source.strides[0], result.y(), result.strides[0], m_map.data(), static_cast<int32_t>(m_width), m_width, m_height);
+    } else if (Mode::SSIM == m_mode) {
+      ssimMap(source.y(), source.strides[0], result.y(), result.strides[0], m_map.data(), static_cast<int32_t>(m_width), m_width, m_height);
+    } else {
+      return;
+    }
+    for (uint32_t y{0}; y < m_height; y++) {
+      const uint8_t *src{m_map.data() + static_cast<std::size_t>(y) * m_width};
+      uint32_t *dst{reinterpret_cast<uint32_t*>(argb + static_cast<std::ptrdiff_t>(y) * stride)};
+      for (uint32_t x{0}; x < m_width; x++) {
+        dst[x] = m_palette[src[x]];
+      }
+    }
+  }
+
+  /**
+   * This function computes 4 * |a - b| per pixel, saturated at 255.
+   */
+  static void absDiff(const uint8_t *a, int32_t strideA, const uint8_t *b, int32_t strideB,
+                      uint8_t *dst, int32_t strideDst, uint32_t width, uint32_t height) noexcept {
+    for (uint32_t y{0}; y < height; y++) {
+      const uint8_t *rowA{a + static_cast<std::ptrdiff_t>(y) * strideA};
+      const uint8_t *rowB{b + static_cast<std::ptrdiff_t>(y) * strideB};
+      uint8_t *rowDst{dst + static_cast<std::ptrdiff_t>(y) * strideDst};
+      uint32_t x{0};
+#if defined(__SSE2__)
+      for (; x + 16 <= width; x += 16) {
+        const __m128i A{_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowA + x))};
+        const __m128i B{_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowB + x))};
+        __m128i d{_mm_or_si128(_mm_subs_epu8(A, B), _mm_subs_epu8(B, A))};
+        d = _mm_adds_epu8(d, d);
+        d = _mm_adds_epu8(d, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rowDst + x), d);
+      }
+#elif defined(__ARM_NEON)
+      for (; x + 16 <= width; x += 16) {
+        vst1q_u8(rowDst + x, vqshlq_n_u8(vabdq_u8(vld1q_u8(rowA + x), vld1q_u8(rowB + x)), 2));
+      }
+#endif
+      for (; x < width; x++) {
+        const int32_t D{std::abs(static_cast<int32_t>(rowA[x]) - static_cast<int32_t>(rowB[x]))};
+        rowDst[x] = static_cast<uint8_t>(std::min(255, D * 4));
+      }
+    }
+  }
+
+  /**
+   * This function computes 2 * (1 - SSIM) per 8x8 block, saturated at 255,
+   * and fills each block with it; blocks at the borders may be smaller.
+   */
+  static void ssimMap(const uint8_t *a, int32_t strideA, const uint8_t *b, int32_t strideB,
+                      uint8_t *dst, int32_t strideDst, uint32_t width, uint32_t height) noexcept {
+    for (uint32_t by{0}; by < height; by += 8) {
+      const uint32_t BH{std::min(8u, height - by)};
+      const uint8_t *rowA{a + static_cast<std::ptrdiff_t>(by) * strideA};
+      const uint8_t *rowB{b + static_cast<std::ptrdiff_t>(by) * strideB};
+      uint8_t *rowDst{dst + static_cast<std::ptrdiff_t>(by) * strideDst};
+      uint32_t bx{0};
+#if defined(__SSE2__)
+      // Two full blocks side by side per iteration.
+      for (; (8 == BH) && (bx + 16 <= width); bx += 16) {
+        const __m128i ZERO{_mm_setzero_si128()};
+        __m128i sumA{ZERO}, sumB{ZERO};
+        __m128i aa[2]{ZERO, ZERO}, bb[2]{ZERO, ZERO}, ab[2]{ZERO, ZERO};
+        for (uint32_t r{0}; r < 8; r++) {
+          const __m128i A{_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowA + r * strideA + bx))};
+          const __m128i B{_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowB + r * strideB + bx))};
+          sumA = _mm_add_epi64(sumA, _mm_sad_epu8(A, ZERO));
+          sumB = _mm_add_epi64(sumB, _mm_sad_epu8(B, ZERO));
+          const __m128i A16[2]{_mm_unpacklo_epi8(A, ZERO), _mm_unpackhi_epi8(A, ZERO)};
+          const __m128i B16[2]{_mm_unpacklo_epi8(B, ZERO), _mm_unpackhi_epi8(B, ZERO)};
+          for (uint32_t i{0}; i < 2; i++) {
+            aa[i] = _mm_add_epi32(aa[i], _mm_madd_epi16(A16[i], A16[i]));
+            bb[i] = _mm_add_epi32(bb[i], _mm_madd_epi16(B16[i], B16[i]));
+            ab[i] = _mm_add_epi32(ab[i], _mm_madd_epi16(A16[i], B16[i]));
+          }
+        }
+        const uint32_t SUM_A[2]{static_cast<uint32_t>(_mm_cvtsi128_si32(sumA)), static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(sumA, 8)))};
+        const uint32_t SUM_B[2]{static_cast<uint32_t>(_mm_cvtsi128_si32(sumB)), static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(sumB, 8)))};
+        for (uint32_t i{0}; i < 2; i++) {
+          const uint8_t V{dissimilarity(SUM_A[i], SUM_B[i], horizontalSum(aa[i]), horizontalSum(bb[i]), horizontalSum(ab[i]), 64)};
+          for (uint32_t r{0}; r < 8; r++) {
+            std::memset(rowDst + r * strideDst + bx + i * 8, V, 8);
+          }
+        }
+      }
+#endif
+      for (; bx < width; bx += 8) {
+        const uint32_t BW{std::min(8u, width - bx)};
+        uint32_t sumA{0}, sumB{0}, aa{0}, bb{0}, ab{0};
+        for (uint32_t r{0}; r < BH; r++) {
+          for (uint32_t c{0}; c < BW; c++) {
+            const uint32_t A{rowA[r * strideA + bx + c]}, B{rowB[r * strideB + bx + c]};
+            sumA += A;
+            sumB += B;
+            aa += A * A;
+            bb += B * B;
+            ab += A * B;
+          }
+        }
+        const uint8_t V{dissimilarity(sumA, sumB, aa, bb, ab, BW * BH)};
+        for (uint32_t r{0}; r < BH; r++) {
+          std::memset(rowDst + r * strideDst + bx, V, BW);
+        }
+      }
+    }
+  }
+
+ private:
+#if defined(__SSE2__)
+  static uint32_t horizontalSum(__m128i v) noexcept {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+  }
+#endif
+
+  static uint8_t dissimilarity(uint32_t sumA, uint32_t sumB, uint32_t aa, uint32_t bb, uint32_t ab, uint32_t n) noexcept {
+    constexpr float C1{6.5025f};  // (0.01 * 255)^2
+    constexpr float C2{58.5225f}; // (0.03 * 255)^2
+    const float N{static_cast<float>(n)};
+    const float MU_A{static_cast<float>(sumA) / N}, MU_B{static_cast<float>(sumB) / N};
+    const float VAR_A{static_cast<float>(aa) / N - MU_A * MU_A};
+    const float VAR_B{static_cast<float>(bb) / N - MU_B * MU_B};
+    const float COV{static_cast<float>(ab) / N - MU_A * MU_B};
+    const float SSIM{((2.0f * MU_A * MU_B + C1) * (2.0f * COV + C2)) / ((MU_A * MU_A + MU_B * MU_B + C1) * (VAR_A + VAR_B + C2))};
+    return static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, (1.0f - SSIM) * 2.0f * 255.0f)));
+  }
+
+ private:
+  Mode m_mode{Mode::OFF};
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  std::vector<uint8_t> m_map;
+  uint32_t m_palette[256]{};
+};
+
+} // namespace ffe
+
+#endif
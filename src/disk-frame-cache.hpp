@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DISK_FRAME_CACHE_HPP
+#define DISK_FRAME_CACHE_HPP
+
+#include "content-hash.hpp"
+#include "frame-buffer-pool.hpp"
+#include "frame-directory.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A DiskFrameCache stores converted i420 frames of one geometry in a folder
+ * so that later processes, e.g., the next CI job, map them instead of
+ * decoding the same PNG files again. Frames are addressed by a hash of the
+ * PNG file, the crop window, and the size of the frame: either cheaply from
+ * the file's name, size, and modification time, or from its full contents
+ * if modification times are not preserved (e.g., fresh checkouts).
+ *
+ * Each file holds a 64-byte header followed by the tightly packed planes.
+ * Files are written under a temporary name and renamed so that concurrent
+ * processes never map a partial frame. The least recently used frames, as
+ * recorded in their modification time, are removed once the folder exceeds
+ * its capacity.
+ */
+class DiskFrameCache {
+ private:
+  DiskFrameCache(const DiskFrameCache &) = delete;
+  DiskFrameCache(DiskFrameCache &&)      = delete;
+  DiskFrameCache &operator=(const DiskFrameCache &) = delete;
+  DiskFrameCache &operator=(DiskFrameCache &&) = delete;
+
+  static constexpr char MAGIC[8]{'F', 'F', 'E', 'I', '4', '2', '0', '1'};
+  static constexpr std::size_t HEADER_SIZE{64};
+
+  struct Header {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t sourceWidth;
+    uint32_t sourceHeight;
+  };
+
+ public:
+  /**
+   * Constructor; indexes the frames already in the folder.
+   *
+   * @param folder Folder of the cache; created if missing.
+   * @param capacity Maximum size of all frames in bytes.
+   * @param width Width of the frames.
+   * @param height Height of the frames.
+   * @param fullHash Address frames by the full contents of the PNG files.
+   */
+  DiskFrameCache(const std::string &folder, uint64_t capacity, uint32_t width, uint32_t height, bool fullHash) noexcept
+    : m_folder((!folder.empty() && ('/' == folder.back())) ? folder : folder + "/")
+    , m_capacity(capacity)
+    , m_width(width)
+    , m_height(height)
+    , m_fullHash(fullHash)
+    , m_byLastUse()
+    , m_entries()
+    , m_view()
+    , m_staging() {
+    ::mkdir(folder.c_str(), 0755);
+    std::vector<std::string> names;
+    m_valid = scanDirectory(folder, SUFFIX, names);
+    for (const auto &name : names) {
+      struct stat st;
+      if (0 == ::stat((m_folder + name).c_str(), &st)) {
+        index(name, static_cast<uint64_t>(st.st_size), st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+      }
+    }
+    m_view.format = PixelFormat::I420;
+    m_view.width = m_width;
+    m_view.height = m_height;
+    m_view.strides[0] = static_cast<int32_t>(m_width);
+    m_view.strides[1] = m_view.strides[2] = static_cast<int32_t>((m_width + 1) / 2);
+    evict();
+  }
+
+  ~DiskFrameCache() noexcept {
+    unmap();
+  }
+
+  bool valid() const noexcept {
+    return m_valid;
+  }
+
+  /**
+   * @param filename PNG file.
+   * @param png Contents of the PNG file; only needed for full hashes.
+   * @param size Size of the PNG file.
+   * @param cropX Left of the crop window.
+   * @param cropY Top of the crop window.
+   * @return Name of the cached frame or empty if the file cannot be identified.
+   */
+  std::string key(const std::string &filename, const unsigned char *png, std::size_t size, uint32_t cropX, uint32_t cropY) const noexcept {
+    uint64_t h{0};
+    if (m_fullHash) {
+      if (nullptr == png) {
+        return "";
+      }
+      h = hash64(png, size);
+    } else {
+      struct stat st;
+      if (0 != ::stat(filename.c_str(), &st)) {
+        return "";
+      }
+      const std::size_t SLASH{filename.find_last_of('/')};
+      const std::string BASENAME{(std::string::npos == SLASH) ? filename : filename.substr(SLASH + 1)};
+      const int64_t META[2]{static_cast<int64_t>(st.st_size), st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec};
+      h = hash64(BASENAME.data(), BASENAME.size(), hash64(META, sizeof(META)));
+    }
+    char name[96];
+    std::snprintf(name, sizeof(name), "%016llx%s-%u_%u_%ux%u%s", static_cast<unsigned long long>(h), (m_fullHash ? "c" : "m"),
+                  cropX, cropY, m_width, m_height, SUFFIX);
+    return name;
+  }
+
+  /**
+   * @return True if a frame is indexed under key; it may have been removed by
+   *         another process meanwhile.
+   */
+  bool contains(const std::string &key) const noexcept {
+    return m_entries.end() != m_entries.find(key);
+  }
+
+  /**
+   * This method maps a cached frame; it remains valid until the next call.
+   *
+   * @param key Name of the frame.
+   * @param sourceWidth Width of the image the frame was converted from.
+   * @param sourceHeight Height of the image the frame was converted from.
+   * @return Cached frame or nullptr.
+   */
+  const FrameBuffer *find(const std::string &key, uint32_t &sourceWidth, uint32_t &sourceHeight) noexcept {
+    unmap();
+    const int fd{key.empty() ? -1 : ::open((m_folder + key).c_str(), O_RDONLY | O_CLOEXEC)};
+    if (0 > fd) {
+      m_misses++;
+      return nullptr;
+    }
+    void *mapping{MAP_FAILED};
+    struct stat st;
+    if ((0 == ::fstat(fd, &st)) && (static_cast<uint64_t>(st.st_size) == fileSize())) {
+      mapping = ::mmap(nullptr, fileSize(), PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    ::close(fd);
+    Header header;
+    if (MAP_FAILED != mapping) {
+      std::memcpy(&header, mapping, sizeof(Header));
+    }
+    if ((MAP_FAILED == mapping) || (0 != std::memcmp(header.magic, MAGIC, sizeof(MAGIC))) ||
+        (m_width != header.width) || (m_height != header.height)) {
+      if (MAP_FAILED != mapping) {
+        ::munmap(mapping, fileSize());
+      }
+      m_misses++;
+      return nullptr;
+    }
+    m_mapping = static_cast<uint8_t*>(mapping);
+    m_view.planes[0] = m_mapping + HEADER_SIZE;
+    m_view.planes[1] = m_view.planes[0] + lumaSize();
+    m_view.planes[2] = m_view.planes[1] + chromaSize();
+    sourceWidth = header.sourceWidth;
+    sourceHeight = header.sourceHeight;
+
+    // The modification time records the last use for eviction.
+    ::utimensat(AT_FDCWD, (m_folder + key).c_str(), nullptr, 0);
+    index(key, fileSize(), now());
+    m_hits++;
+    return &m_view;
+  }
+
+  /**
+   * This method stores a frame.
+   *
+   * @param key Name of the frame.
+   * @param i420 Frame of the geometry of the cache.
+   * @param sourceWidth Width of the image the frame was converted from.
+   * @param sourceHeight Height of the image the frame was converted from.
+   */
+  void store(const std::string &key, const FrameBuffer &i420, uint32_t sourceWidth, uint32_t sourceHeight) noexcept {
+    if (key.empty() || (m_width != i420.width) || (m_height != i420.height) || (fileSize() > m_capacity)) {
+      return;
+    }
+    m_staging.assign(fileSize(), 0);
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.width = m_width;
+    header.height = m_height;
+    header.sourceWidth = sourceWidth;
+    header.sourceHeight = sourceHeight;
+    std::memcpy(m_staging.data(), &header, sizeof(Header));
+    uint8_t *dst{m_staging.data() + HEADER_SIZE};
+    for (uint32_t p{0}; p < 3; p++) {
+      const uint32_t W{(0 == p) ? m_width : (m_width + 1) / 2};
+      const uint32_t H{(0 == p) ? m_height : (m_height + 1) / 2};
+      for (uint32_t y{0}; y < H; y++, dst += W) {
+        std::memcpy(dst, i420.planes[p] + y * static_cast<uint32_t>(i420.strides[p]), W);
+      }
+    }
+
+    const std::string TMP{m_folder + key + ".tmp-" + std::to_string(::getpid())};
+    const int fd{::open(TMP.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if (0 > fd) {
+      return;
+    }
+    std::size_t written{0};
+    while (written < m_staging.size()) {
+      const ssize_t N{::write(fd, m_staging.data() + written, m_staging.size() - written)};
+      if (0 >= N) {
+        break;
+      }
+      written += static_cast<std::size_t>(N);
+    }
+    ::close(fd);
+    if ((written != m_staging.size()) || (0 != std::rename(TMP.c_str(), (m_folder + key).c_str()))) {
+      std::remove(TMP.c_str());
+      return;
+    }
+    m_stores++;
+    index(key, fileSize(), now());
+    evict();
+  }
+
+  uint64_t hits() const noexcept {
+    return m_hits;
+  }
+
+  uint64_t misses() const noexcept {
+    return m_misses;
+  }
+
+  uint64_t stores() const noexcept {
+    return m_stores;
+  }
+
+  uint64_t evictions() const noexcept {
+    return m_evictions;
+  }
+
+ private:
+  static constexpr const char *SUFFIX{".i420"};
+
+  uint64_t lumaSize() const noexcept {
+    return static_cast<uint64_t>(m_width) * m_height;
+  }
+
+  uint64_t chromaSize() const noexcept {
+    return static_cast<uint64_t>((m_width + 1) / 2) * ((m_height + 1) / 2);
+  }
+
+  uint64_t fileSize() const noexcept {
+    return HEADER_SIZE + lumaSize() + 2 * chromaSize();
+  }
+
+  static int64_t now() noexcept {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  void unmap() noexcept {
+    if (nullptr != m_mapping) {
+      ::munmap(m_mapping, fileSize());
+      m_mapping = nullptr;
+    }
+  }
+
+  void index(const std::string &name, uint64_t size, int64_t lastUse) noexcept {
+    auto it = m_entries.find(name);
+    if (m_entries.end() != it) {
+      m_size -= it->second.second;
+      m_byLastUse.erase(it->second.first);
+      m_entries.erase(it);
+    }
+    m_entries.emplace(name, std::make_pair(m_byLastUse.emplace(lastUse, name), size));
+    m_size += size;
+  }
+
+  void evict() noexcept {
+    while ((m_size > m_capacity) && !m_byLastUse.empty()) {
+      const std::string NAME{m_byLastUse.begin()->second};
+      // Other processes may have removed it already.
+      ::unlink((m_folder + NAME).c_str());
+      auto it = m_entries.find(NAME);
+      m_size -= it->second.second;
+      m_byLastUse.erase(it->second.first);
+      m_entries.erase(it);
+      m_evictions++;
+    }
+  }
+
+ private:
+  std::string m_folder;
+  uint64_t m_capacity{0};
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  bool m_fullHash{false};
+  bool m_valid{false};
+  std::multimap<int64_t, std::string> m_byLastUse;
+  std::unordered_map<std::string, std::pair<std::multimap<int64_t, std::string>::iterator, uint64_t>> m_entries;
+  uint64_t m_size{0};
+  FrameBuffer m_view;
+  uint8_t *m_mapping{nullptr};
+  std::vector<uint8_t> m_staging;
+  uint64_t m_hits{0};
+  uint64_t m_misses{0};
+  uint64_t m_stores{0};
+  uint64_t m_evictions{0};
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FAKE_ENCODER_HPP
+#define FAKE_ENCODER_HPP
+
+#include "cluon-complete.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A FakeEncoder stands in for an encoder process: it attaches to the shared
+ * i420 frame, waits for notifications, and immediately replies with the next
+ * canned ImageReading over its own OD4Session. Together with a synthetic
+ * source, it measures the evaluator's own maximum frame rate and latency floor.
+ */
+class FakeEncoder {
+ private:
+  FakeEncoder(const FakeEncoder &) = delete;
+  FakeEncoder(FakeEncoder &&)      = delete;
+  FakeEncoder &operator=(const FakeEncoder &) = delete;
+  FakeEncoder &operator=(FakeEncoder &&) = delete;
+
+ public:
+  // OD4 sends every ImageReading as one UDP datagram of at most 65507 bytes,
+  // including the envelope.
+  static constexpr std::size_t MAX_FRAME_SIZE{60000};
+
+  /**
+   * @return Bitrate at 30 fps for canned frames of the given size whose mean
+   *         frame is an eighth of MAX_FRAME_SIZE to leave room for key frames.
+   */
+  static uint32_t bitrateKbps(uint32_t width, uint32_t height) noexcept {
+    return std::min<uint32_t>(width * height / 800, MAX_FRAME_SIZE / 8 * 8 * 30 / 1000);
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param name Name of the shared memory to attach to.
+   * @param cid CID of the OD4Session to reply on.
+   * @param fourcc Codec of the canned frames (VP80, VP90, h264).
+   * @param width Width of the canned frames.
+   * @param height Height of the canned frames.
+   * @param frames Canned encoded frames replayed in a loop.
+   */
+  FakeEncoder(const std::string &name, uint16_t cid, const std::string &fourcc, uint32_t width, uint32_t height, std::vector<std::string> &&frames) noexcept
+    : m_name(name)
+    , m_od4(new cluon::OD4Session{cid})
+    , m_fourcc(fourcc)
+    , m_width(width)
+    , m_height(height)
+    , m_frames(std::move(frames))
+    , m_thread() {
+    m_thread = std::thread(&FakeEncoder::run, this);
+  }
+
+  ~FakeEncoder() noexcept {
+    m_running.store(false);
+    // Wake up the thread until it left waiting on the shared condition.
+    while (!m_finished.load()) {
+      if (m_attached.load()) {
+        m_sharedMemory->notifyAll();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+ private:
+  void run() noexcept {
+    using namespace std::literals::chrono_literals;
+    // Attach once the evaluator has created the shared memory.
+    while (m_running.load() && !(m_sharedMemory && m_sharedMemory->valid())) {
+      std::unique_ptr<cluon::SharedMemory> sm{new cluon::SharedMemory{m_name}};
+      if (sm->valid()) {
+        m_sharedMemory = std::move(sm);
+        m_attached.store(true);
+      } else {
+        std::this_thread::sleep_for(10ms);
+      }
+    }
+
+    uint32_t counter{0};
+    while (m_running.load() && !m_frames.empty()) {
+      m_sharedMemory->wait();
+      if (!m_running.load()) {
+        break;
+      }
+      cluon::data::TimeStamp sampleTime{cluon::time::now()};
+      m_sharedMemory->lock();
+      {
+        auto ts = m_sharedMemory->getTimeStamp();
+        if (ts.first) {
+          sampleTime = ts.second;
+        }
+      }
+      m_sharedMemory->unlock();
+
+      opendlv::proxy::ImageReading ir;
+      ir.fourcc(m_fourcc).width(m_width).height(m_height).data(m_frames[counter++ % m_frames.size()]);
+      m_od4->send(ir, sampleTime);
+    }
+    m_finished.store(true);
+  }
+
+ private:
+  std::string m_name;
+  std::unique_ptr<cluon::OD4Session> m_od4;
+  std::string m_fourcc;
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  std::vector<std::string> m_frames;
+  std::unique_ptr<cluon::SharedMemory> m_sharedMemory{nullptr};
+  std::atomic<bool> m_attached{false};
+  std::atomic<bool> m_running{true};
+  std::atomic<bool> m_finished{false};
+  std::thread m_thread;
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FOLDER_WATCHER_HPP
+#define FOLDER_WATCHER_HPP
+
+#include "frame-directory.hpp"
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A FolderWatcher hands out frames as they land in a folder, i.e., once they
+ * were closed after writing (IN_CLOSE_WRITE) or moved into it (IN_MOVED_TO).
+ *
+ * Frames are expected to be written in natural order as capture rigs do;
+ * a frame that does not sort after the last one handed out is skipped unless
+ * it was part of the initial listing, whose late close events are expected.
+ * This avoids duplicates with the initial listing and keeps the memory bounded:
+ * events are only read from the kernel once all pending frames were consumed
+ * so that a slow evaluator backs up into the inotify queue. If that queue
+ * overflows, the folder is rescanned for frames after the last one.
+ */
+class FolderWatcher {
+ private:
+  FolderWatcher(const FolderWatcher &) = delete;
+  FolderWatcher(FolderWatcher &&)      = delete;
+  FolderWatcher &operator=(const FolderWatcher &) = delete;
+  FolderWatcher &operator=(FolderWatcher &&) = delete;
+
+ public:
+  /**
+   * Constructor; starts watching right away so that no frame is missed
+   * while the folder is listed afterwards.
+   *
+   * @param folder Folder to watch.
+   * @param suffix Exact suffix of the frames (e.g., .png).
+   */
+  FolderWatcher(const std::string &folder, const std::string &suffix) noexcept
+    : m_folder(folder)
+    , m_prefix((!folder.empty() && ('/' == folder.back())) ? folder : folder + "/")
+    , m_suffix(suffix)
+    , m_pending()
+    , m_last()
+    , m_listed()
+    , m_buffer(BUFFER_SIZE) {
+    m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if ((0 <= m_fd) && (0 > ::inotify_add_watch(m_fd, m_folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO))) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+  ~FolderWatcher() noexcept {
+    if (0 <= m_fd) {
+      ::close(m_fd);
+    }
+  }
+
+  bool valid() const noexcept {
+    return (0 <= m_fd);
+  }
+
+  /**
+   * This method marks the frames of the initial listing as handed out.
+   *
+   * @param filenames Paths of the frames in natural order.
+   */
+  void listed(const std::vector<std::string> &filenames) noexcept {
+    for (const auto &filename : filenames) {
+      m_listed.insert(name(filename));
+    }
+    if (!filenames.empty()) {
+      m_last = filenames.back();
+    }
+  }
+
+  /**
+   * This method waits up to POLL_TIMEOUT_MS for the next frame to land so
+   * that the caller can do periodic work while the folder is idle.
+   *
+   * @param filename Path of the next frame.
+   * @return false if no frame landed or the watch failed (see valid()).
+   */
+  bool next(std::string &filename) noexcept {
+    if (m_pending.empty() && valid()) {
+      struct pollfd pfd{m_fd, POLLIN, 0};
+      if (0 < ::poll(&pfd, 1, POLL_TIMEOUT_MS)) {
+        read();
+      }
+    }
+    if (m_pending.empty()) {
+      return false;
+    }
+    filename = m_prefix + m_pending.front();
+    m_pending.pop_front();
+    m_last = filename;
+    return true;
+  }
+
+  /**
+   * @return Number of frames skipped as they landed out of order.
+   */
+  uint64_t skipped() const noexcept {
+    return m_skipped;
+  }
+
+  /**
+   * @return Number of overflows of the inotify queue.
+   */
+  uint64_t overflows() const noexcept {
+    return m_overflows;
+  }
+
+ private:
+  void read() noexcept {
+    bool overflow{false};
+    std::vector<std::string> names;
+    while (true) {
+      const ssize_t N{::read(m_fd, m_buffer.data(), m_buffer.size())};
+      if (0 >= N) {
+        break;
+      }
+      for (ssize_t offset{0}; offset < N;) {
+        const struct inotify_event *event{reinterpret_cast<const struct inotify_event*>(m_buffer.data() + offset)};
+        offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+        if (0 != (event->mask & IN_Q_OVERFLOW)) {
+          overflow = true;
+        } else if (0 != (event->mask & IN_IGNORED)) {
+          // The folder itself was removed or unmounted.
+          ::close(m_fd);
+          m_fd = -1;
+          return;
+        } else if (0 < event->len) {
+          const std::size_t LENGTH{std::strlen(event->name)};
+          if ((LENGTH > m_suffix.size()) && (0 == std::memcmp(event->name + LENGTH - m_suffix.size(), m_suffix.data(), m_suffix.size()))) {
+            names.emplace_back(event->name, LENGTH);
+          }
+        }
+      }
+    }
+    if (overflow) {
+      m_overflows++;
+      names.clear();
+      scanDirectory(m_folder, m_suffix, names);
+    }
+
+    // Frames written concurrently may be closed in any order.
+    sortNatural(names);
+    std::string last{name(m_last)};
+    for (auto &n : names) {
+      if (last.empty() || naturalLess(last, n)) {
+        last = n;
+        m_pending.push_back(std::move(n));
+      } else if (0 < m_listed.erase(n)) {
+        // Closed after the initial listing, which handed it out already.
+      } else if (!overflow && (last != n)) {
+        m_skipped++;
+      }
+    }
+  }
+
+  std::string name(const std::string &filename) const noexcept {
+    return (0 == filename.compare(0, m_prefix.size(), m_prefix)) ? filename.substr(m_prefix.size()) : filename;
+  }
+
+ private:
+  static constexpr std::size_t BUFFER_SIZE{64 * 1024};
+  static constexpr int POLL_TIMEOUT_MS{100};
+
+  std::string m_folder;
+  std::string m_prefix;
+  std::string m_suffix;
+  int m_fd{-1};
+  std::deque<std::string> m_pending;
+  std::string m_last;
+  // Frames of the initial listing whose events may still arrive.
+  std::unordered_set<std::string> m_listed;
+  std::vector<char> m_buffer;
+  uint64_t m_skipped{0};
+  uint64_t m_overflows{0};
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_BUFFER_POOL_HPP
+#define FRAME_BUFFER_POOL_HPP
+
+#include <sys/mman.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Row and plane alignment for all pooled buffers; matches a cache line and
+ * the widest SIMD loads used by libyuv.
+ */
+constexpr uint32_t FRAME_BUFFER_ALIGNMENT{64};
+
+/**
+ * @return value rounded up to the next multiple of alignment (power of two).
+ */
+inline constexpr uint32_t alignUp(uint32_t value, uint32_t alignment) noexcept {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+enum class PixelFormat : uint8_t {
+  I420, // Three planes Y, U, V; chroma subsampled by two in both directions.
+  ARGB, // One plane with four bytes per pixel (ARGB or ABGR byte order).
+};
+
+/**
+ * A FrameBuffer describes one pooled image of fixed geometry. Every plane
+ * starts at a 64-byte boundary and every row is padded to a multiple of
+ * the row alignment of its pool.
+ */
+struct FrameBuffer {
+  PixelFormat format{PixelFormat::I420};
+  uint32_t width{0};
+  uint32_t height{0};
+  uint8_t *planes[3]{nullptr, nullptr, nullptr};
+  int32_t strides[3]{0, 0, 0};
+
+  uint8_t *y() const noexcept { return planes[0]; }
+  uint8_t *u() const noexcept { return planes[1]; }
+  uint8_t *v() const noexcept { return planes[2]; }
+  uint8_t *data() const noexcept { return planes[0]; }
+  int32_t stride() const noexcept { return strides[0]; }
+
+  /**
+   * @return True for an i420 frame laid out like the shared memory: planes
+   *         without padding, directly one after another.
+   */
+  bool packed() const noexcept {
+    const std::size_t LUMA{static_cast<std::size_t>(width) * height};
+    return (PixelFormat::I420 == format) &&
+           (static_cast<int32_t>(width) == strides[0]) && (static_cast<int32_t>(width / 2) == strides[1]) && (strides[1] == strides[2]) &&
+           (planes[0] + LUMA == planes[1]) && (planes[1] + (LUMA >> 2) == planes[2]);
+  }
+};
+
+class FrameBufferPool;
+
+/**
+ * Deleter returning a FrameBuffer to its pool instead of freeing it.
+ */
+struct FrameBufferRecycler {
+  FrameBufferPool *pool{nullptr};
+  void operator()(FrameBuffer *buffer) const noexcept;
+};
+
+using FrameBufferHandle = std::unique_ptr<FrameBuffer, FrameBufferRecycler>;
+
+/**
+ * A FrameBufferPool pre-allocates a fixed number of equally sized frame
+ * buffers from one slab of anonymous memory at construction time. Buffers
+ * are handed out as RAII handles and recycled on release, so steady state
+ * processing does not touch the heap at all.
+ */
+class FrameBufferPool {
+ private:
+  FrameBufferPool(const FrameBufferPool &) = delete;
+  FrameBufferPool(FrameBufferPool &&)      = delete;
+  FrameBufferPool &operator=(const FrameBufferPool &) = delete;
+  FrameBufferPool &operator=(FrameBufferPool &&) = delete;
+
+ public:
+  /**
+   * Constructor.
+   *
+   * @param format Pixel format of all buffers in this pool.
+   * @param width Width in pixels.
+   * @param height Height in pixels.
+   * @param capacity Number of buffers to pre-allocate.
+   * @param useHugePages Try to back the slab with huge pages (MAP_HUGETLB, falling back to MADV_HUGEPAGE).
+   * @param rowAlignment Alignment of each row in bytes (power of two); use 1 for tightly packed rows.
+   */
+  FrameBufferPool(PixelFormat format, uint32_t width, uint32_t height, uint32_t capacity,
+                  bool useHugePages = false, uint32_t rowAlignment = FRAME_BUFFER_ALIGNMENT) noexcept
+    : m_buffers(capacity)
+    , m_free() {
+    // Compute the layout of one buffer.
+    FrameBuffer prototype;
+    prototype.format = format;
+    prototype.width = width;
+    prototype.height = height;
+    std::size_t offsets[3]{0, 0, 0};
+    std::size_t bytes{0};
+    if (PixelFormat::I420 == format) {
+      const uint32_t chromaWidth{(width + 1) / 2};
+      const uint32_t chromaHeight{(height + 1) / 2};
+      prototype.strides[0] = static_cast<int32_t>(alignUp(width, rowAlignment));
+      prototype.strides[1] = static_cast<int32_t>(alignUp(chromaWidth, rowAlignment));
+      prototype.strides[2] = prototype.strides[1];
+      offsets[0] = 0;
+      offsets[1] = alignUp(static_cast<uint32_t>(prototype.strides[0]) * height, FRAME_BUFFER_ALIGNMENT);
+      offsets[2] = offsets[1] + alignUp(static_cast<uint32_t>(prototype.strides[1]) * chromaHeight, FRAME_BUFFER_ALIGNMENT);
+      bytes = offsets[2] + static_cast<uint32_t>(prototype.strides[2]) * chromaHeight;
+    } else {
+      prototype.strides[0] = static_cast<int32_t>(alignUp(width * 4, rowAlignment));
+      bytes = static_cast<uint32_t>(prototype.strides[0]) * height;
+    }
+    m_bufferSize = alignUp(static_cast<uint32_t>(bytes), FRAME_BUFFER_ALIGNMENT);
+
+    // Allocate the slab for all buffers at once.
+    m_slabSize = m_bufferSize * capacity;
+    if (0 < m_slabSize) {
+      void *slab{MAP_FAILED};
+#ifdef MAP_HUGETLB
+      if (useHugePages) {
+        constexpr std::size_t HUGE_PAGE_SIZE{2 * 1024 * 1024};
+        const std::size_t hugeSlabSize{(m_slabSize + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1)};
+        slab = ::mmap(nullptr, hugeSlabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED != slab) {
+          m_slabSize = hugeSlabSize;
+          m_usesHugePages = true;
+        }
+      }
+#endif
+      if (MAP_FAILED == slab) {
+        slab = ::mmap(nullptr, m_slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+        if ((MAP_FAILED != slab) && useHugePages) {
+          m_usesHugePages = (0 == ::madvise(slab, m_slabSize, MADV_HUGEPAGE));
+        }
+#endif
+      }
+      if (MAP_FAILED != slab) {
+        m_slab = static_cast<uint8_t *>(slab);
+      }
+    }
+
+    // Carve the slab into buffers.
+    m_free.reserve(capacity);
+    for (uint32_t i{0}; (nullptr != m_slab) && (i < capacity); i++) {
+      FrameBuffer &buffer = m_buffers[i];
+      buffer = prototype;
+      uint8_t *base{m_slab + i * m_bufferSize};
+      buffer.planes[0] = base + offsets[0];
+      if (PixelFormat::I420 == format) {
+        buffer.planes[1] = base + offsets[1];
+        buffer.planes[2] = base + offsets[2];
+      }
+      m_free.push_back(&buffer);
+    }
+  }
+
+  ~FrameBufferPool() noexcept {
+    if (nullptr != m_slab) {
+      ::munmap(m_slab, m_slabSize);
+    }
+  }
+
+ public:
+  /**
+   * @return Handle to a free buffer or an empty handle when the pool is exhausted.
+   */
+  FrameBufferHandle acquire() noexcept {
+    std::lock_guard<std::mutex> lck(m_freeMutex);
+    if (m_free.empty()) {
+      return FrameBufferHandle{nullptr, FrameBufferRecycler{this}};
+    }
+    FrameBuffer *buffer{m_free.back()};
+    m_free.pop_back();
+    return FrameBufferHandle{buffer, FrameBufferRecycler{this}};
+  }
+
+  /**
+   * @return True if the slab could be allocated.
+   */
+  bool valid() const noexcept {
+    return nullptr != m_slab;
+  }
+
+  /**
+   * @return True if the slab is backed by huge pages.
+   */
+  bool usesHugePages() const noexcept {
+    return m_usesHugePages;
+  }
+
+  /**
+   * @return Size of one buffer in bytes including padding.
+   */
+  std::size_t bufferSize() const noexcept {
+    return m_bufferSize;
+  }
+
+  /**
+   * @return Number of buffers currently available.
+   */
+  std::size_t available() noexcept {
+    std::lock_guard<std::mutex> lck(m_freeMutex);
+    return m_free.size();
+  }
+
+ private:
+  friend struct FrameBufferRecycler;
+  void release(FrameBuffer *buffer) noexcept {
+    std::lock_guard<std::mutex> lck(m_freeMutex);
+    m_free.push_back(buffer);
+  }
+
+ private:
+  std::vector<FrameBuffer> m_buffers;
+  std::mutex m_freeMutex{};
+  std::vector<FrameBuffer *> m_free;
+  uint8_t *m_slab{nullptr};
+  std::size_t m_slabSize{0};
+  std::size_t m_bufferSize{0};
+  bool m_usesHugePages{false};
+};
+
+inline void FrameBufferRecycler::operator()(FrameBuffer *buffer) const noexcept {
+  if ((nullptr != pool) && (nullptr != buffer)) {
+    pool->release(buffer);
+  }
+}
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_CACHE_HPP
+#define FRAME_CACHE_HPP
+
+#include "frame-buffer-pool.hpp"
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+namespace ffe {
+
+/**
+ * A FrameCache keeps the most recently converted i420 frames of one geometry
+ * so that repeated replays of the same folder skip reading and decoding. All
+ * frames live in one FrameBufferPool sized at construction time; when it is
+ * exhausted, the least recently used frame is evicted.
+ */
+class FrameCache {
+ private:
+  FrameCache(const FrameCache &) = delete;
+  FrameCache(FrameCache &&)      = delete;
+  FrameCache &operator=(const FrameCache &) = delete;
+  FrameCache &operator=(FrameCache &&) = delete;
+
+  struct Entry {
+    std::string key{};
+    uint32_t sourceWidth{0};
+    uint32_t sourceHeight{0};
+    FrameBufferHandle frame{nullptr, FrameBufferRecycler{}};
+  };
+
+ public:
+  /**
+   * Constructor.
+   *
+   * @param width Width of the cached frames.
+   * @param height Height of the cached frames.
+   * @param capacity Maximum number of cached frames.
+   * @param useHugePages Back the frames with huge pages if available.
+   */
+  FrameCache(uint32_t width, uint32_t height, uint32_t capacity, bool useHugePages) noexcept
+    : m_pool(PixelFormat::I420, width, height, capacity, useHugePages)
+    , m_lru()
+    , m_index() {
+    m_index.reserve(capacity);
+  }
+
+  /**
+   * @param filename Source of the frame.
+   * @param cropX Left of the crop window.
+   * @param cropY Top of the crop window.
+   * @return Key for a frame converted from filename with the given crop
+   *         window; the size of the window is that of the cache.
+   */
+  static std::string key(const std::string &filename, uint32_t cropX, uint32_t cropY) noexcept {
+    return filename + ";" + std::to_string(cropX) + ";" + std::to_string(cropY);
+  }
+
+  bool valid() const noexcept {
+    return m_pool.valid();
+  }
+
+  /**
+   * @return True if a frame is cached under key; does not count as use.
+   */
+  bool contains(const std::string &key) const noexcept {
+    return m_index.end() != m_index.find(key);
+  }
+
+  /**
+   * This method looks up a frame and marks it as most recently used. The
+   * frame remains valid until the next call to insert.
+   *
+   * @param key Key of the frame.
+   * @param sourceWidth Width of the image the frame was converted from.
+   * @param sourceHeight Height of the image the frame was converted from.
+   * @return Cached frame or nullptr.
+   */
+  const FrameBuffer *find(const std::string &key, uint32_t &sourceWidth, uint32_t &sourceHeight) noexcept {
+    auto it = m_index.find(key);
+    if (m_index.end() == it) {
+      m_misses++;
+      return nullptr;
+    }
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    sourceWidth = it->second->sourceWidth;
+    sourceHeight = it->second->sourceHeight;
+    return it->second->frame.get();
+  }
+
+  /**
+   * This method reserves a frame for the given key, evicting the least
+   * recently used one if necessary; the caller fills it right away.
+   *
+   * @param key Key of the frame.
+   * @param sourceWidth Width of the image the frame is converted from.
+   * @param sourceHeight Height of the image the frame is converted from.
+   * @return Frame to fill or nullptr if the cache is unusable.
+   */
+  FrameBuffer *insert(const std::string &key, uint32_t sourceWidth, uint32_t sourceHeight) noexcept {
+    erase(key);
+    FrameBufferHandle frame{m_pool.acquire()};
+    if (!frame && !m_lru.empty()) {
+      m_index.erase(m_lru.back().key);
+      frame = std::move(m_lru.back().frame);
+      m_lru.pop_back();
+      m_evictions++;
+    }
+    if (!frame) {
+      return nullptr;
+    }
+    m_lru.push_front(Entry{key, sourceWidth, sourceHeight, std::move(frame)});
+    m_index[key] = m_lru.begin();
+    return m_lru.front().frame.get();
+  }
+
+  /**
+   * This method drops a frame, e.g., if filling it failed.
+   *
+   * @param key Key of the frame.
+   */
+  void erase(const std::string &key) noexcept {
+    auto it = m_index.find(key);
+    if (m_index.end() != it) {
+      m_lru.erase(it->second);
+      m_index.erase(it);
+    }
+  }
+
+  std::size_t size() const noexcept {
+    return m_lru.size();
+  }
+
+  uint64_t hits() const noexcept {
+    return m_hits;
+  }
+
+  uint64_t misses() const noexcept {
+    return m_misses;
+  }
+
+  uint64_t evictions() const noexcept {
+    return m_evictions;
+  }
+
+ private:
+  FrameBufferPool m_pool;
+  std::list<Entry> m_lru;
+  std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+  uint64_t m_hits{0};
+  uint64_t m_misses{0};
+  uint64_t m_evictions{0};
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DIRECTORY_HPP
+#define FRAME_DIRECTORY_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * This function computes a key for sorting file names in natural order:
+ * runs of digits compare by their numeric value so that frame-9.png precedes
+ * frame-10.png regardless of zero padding; all other characters compare
+ * bytewise. Keys compare with memcmp, so that sorting large folders does not
+ * parse the names over and over again.
+ *
+ * @param name File name.
+ * @return Key for name.
+ */
+inline std::string naturalKey(const std::string &name) noexcept {
+  // A run of digits becomes '0', its length without leading zeros, and the
+  // significant digits. As digits only occur in runs, the leading '0' keeps
+  // the order of digits and other characters and the length orders the numbers.
+  std::string key;
+  key.reserve(name.size() + 8);
+  for (std::size_t i{0}; i < name.size();) {
+    if (('0' <= name[i]) && ('9' >= name[i])) {
+      while ((i + 1 < name.size()) && ('0' == name[i]) && ('0' <= name[i + 1]) && ('9' >= name[i + 1])) {
+        i++;
+      }
+      std::size_t end{i};
+      while ((end < name.size()) && ('0' <= name[end]) && ('9' >= name[end]) && (end - i < 255)) {
+        end++;
+      }
+      key.push_back('0');
+      key.push_back(static_cast<char>(end - i));
+      key.append(name, i, end - i);
+      i = end;
+    } else {
+      key.push_back(name[i++]);
+    }
+  }
+  return key;
+}
+
+/**
+ * @param a Left-hand side.
+ * @param b Right-hand side.
+ * @return true if a precedes b in natural order (see naturalKey).
+ */
+inline bool naturalLess(const std::string &a, const std::string &b) noexcept {
+  const std::string KEY_A{naturalKey(a)}, KEY_B{naturalKey(b)};
+  return (KEY_A != KEY_B) ? (KEY_A < KEY_B) : (a < b);
+}
+
+/**
+ * This function sorts file names in natural order (see naturalKey). Frame
+ * folders usually hold names like <prefix><number><suffix> with the same
+ * prefix and suffix throughout; then, only the parsed numbers are sorted.
+ *
+ * @param names Names to sort.
+ */
+inline void sortNatural(std::vector<std::string> &names) noexcept {
+  // Number, negated length of the run of digits, and position of each name.
+  std::vector<std::tuple<uint64_t, int32_t, uint32_t>> numbers;
+  numbers.reserve(names.size());
+  std::size_t prefixLength{0}, suffixLength{0};
+  for (std::size_t i{0}; i < names.size(); i++) {
+    const std::string &name{names[i]};
+    std::size_t end{name.find_last_of("0123456789")};
+    if (std::string::npos == end) {
+      break;
+    }
+    end++;
+    std::size_t begin{end};
+    while ((0 < begin) && ('0' <= name[begin - 1]) && ('9' >= name[begin - 1])) {
+      begin--;
+    }
+    if (0 == i) {
+      prefixLength = begin;
+      suffixLength = name.size() - end;
+    }
+    if ((begin != prefixLength) || (name.size() - end != suffixLength) ||
+        (0 != name.compare(0, begin, names[0], 0, prefixLength)) ||
+        (0 != name.compare(end, std::string::npos, names[0], names[0].size() - suffixLength, suffixLength))) {
+      break;
+    }
+    std::size_t first{begin};
+    while ((first + 1 < end) && ('0' == name[first])) {
+      first++;
+    }
+    if (19 < end - first) {
+      break;
+    }
+    uint64_t number{0};
+    for (std::size_t j{first}; j < end; j++) {
+      number = number * 10 + static_cast<uint64_t>(name[j] - '0');
+    }
+    numbers.emplace_back(number, -static_cast<int32_t>(end - begin), static_cast<uint32_t>(i));
+  }
+
+  std::vector<std::string> sorted;
+  sorted.reserve(names.size());
+  if (numbers.size() == names.size()) {
+    // Equal numbers differ only in zero padding; as with the names below,
+    // the longer run goes first.
+    std::sort(numbers.begin(), numbers.end());
+    for (const auto &number : numbers) {
+      sorted.push_back(std::move(names[std::get<2>(number)]));
+    }
+  } else {
+    // Equal keys differ only in zero padding; the name after the key breaks the tie.
+    for (const auto &name : names) {
+      sorted.push_back(naturalKey(name).append(1, '\0').append(name));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (auto &entry : sorted) {
+      entry.erase(0, entry.find('\0') + 1);
+    }
+  }
+  names.swap(sorted);
+}
+
+/**
+ * This function lists the regular files in a folder whose names end with
+ * the given suffix. Instead of one readdir call per entry, getdents64 fills
+ * a large buffer per system call, which matters for folders with hundreds of
+ * thousands of frames on network storage.
+ *
+ * @param folder Folder to scan.
+ * @param suffix Exact suffix of the names to keep (e.g., .png).
+ * @param names Resulting names without folder in directory order.
+ * @return true if the folder could be read.
+ */
+inline bool scanDirectory(const std::string &folder, const std::string &suffix, std::vector<std::string> &names) noexcept {
+  names.clear();
+  const int fd{::open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+  if (0 > fd) {
+    return false;
+  }
+  // Layout of the records returned by getdents64 (see getdents(2)).
+  struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+  };
+  constexpr std::size_t BUFFER_SIZE{1024 * 1024};
+  std::vector<char> buffer(BUFFER_SIZE);
+  bool retVal{true};
+  while (true) {
+    const long N{::syscall(SYS_getdents64, fd, buffer.data(), BUFFER_SIZE)};
+    if (0 >= N) {
+      retVal = (0 == N);
+      break;
+    }
+    for (long offset{0}; offset < N;) {
+      const LinuxDirent64 *entry{reinterpret_cast<const LinuxDirent64*>(buffer.data() + offset)};
+      offset += entry->d_reclen;
+      if ((DT_REG != entry->d_type) && (DT_LNK != entry->d_type) && (DT_UNKNOWN != entry->d_type)) {
+        continue;
+      }
+      const std::size_t LENGTH{std::strlen(entry->d_name)};
+      if ((LENGTH > suffix.size()) && (0 == std::memcmp(entry->d_name + LENGTH - suffix.size(), suffix.data(), suffix.size()))) {
+        names.emplace_back(entry->d_name, LENGTH);
+      }
+    }
+  }
+  ::close(fd);
+  return retVal;
+}
+
+/**
+ * This function returns the frames of a folder in natural order. With a
+ * manifest, the sorted list is cached in a file that is tagged with the
+ * folder's modification time; as long as no entries were added or removed
+ * since, repeated runs read the manifest and skip the scan entirely.
+ *
+ * @param folder Folder with the frames.
+ * @param suffix Exact suffix of the frames (e.g., .png).
+ * @param manifest File to read the list from or store it to; empty to always scan.
+ * @param entries Resulting paths of the frames.
+ * @param fromManifest true if entries were read from the manifest.
+ * @return true if the folder could be read.
+ */
+inline bool listFrames(const std::string &folder, const std::string &suffix, const std::string &manifest, std::vector<std::string> &entries, bool &fromManifest) noexcept {
+  entries.clear();
+  fromManifest = false;
+  struct stat folderStat;
+  if (0 != ::stat(folder.c_str(), &folderStat)) {
+    return false;
+  }
+  const std::string PREFIX{(!folder.empty() && ('/' == folder.back())) ? folder : folder + "/"};
+  std::string tag;
+  {
+    std::stringstream sstr;
+    sstr << "# frame-feed-evaluator: manifest;" << folder << ";" << folderStat.st_mtim.tv_sec << "." << folderStat.st_mtim.tv_nsec << ";" << suffix;
+    tag = sstr.str();
+  }
+
+  if (!manifest.empty()) {
+    std::ifstream in{manifest};
+    std::string line;
+    if (in.good() && std::getline(in, line) && (line == tag)) {
+      while (std::getline(in, line)) {
+        if (!line.empty()) {
+          entries.push_back(PREFIX + line);
+        }
+      }
+      fromManifest = true;
+      return true;
+    }
+  }
+
+  std::vector<std::string> names;
+  if (!scanDirectory(folder, suffix, names)) {
+    return false;
+  }
+  sortNatural(names);
+
+  if (!manifest.empty()) {
+    // Replace the manifest atomically so that concurrent runs never read a partial list.
+    const std::string TMP{manifest + ".tmp"};
+    bool written{false};
+    {
+      std::ofstream out{TMP, std::ios::trunc};
+      out << tag << '\n';
+      for (const auto &name : names) {
+        out << name << '\n';
+      }
+      out.flush();
+      written = out.good();
+    }
+    if (!written || (0 != std::rename(TMP.c_str(), manifest.c_str()))) {
+      std::remove(TMP.c_str());
+    }
+  }
+
+  entries.reserve(names.size());
+  for (const auto &name : names) {
+    entries.push_back(PREFIX + name);
+  }
+  return true;
+}
+
+} // namespace ffe
+
+#endif
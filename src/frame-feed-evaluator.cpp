@@ -19,19 +19,42 @@
 #include "opendlv-standard-message-set.hpp"
 
 #include "lodepng.h"
+#include "frame-buffer-pool.hpp"
+#include "shared-memory-tuning.hpp"
+#include "cpu-affinity.hpp"
+#include "trace-recorder.hpp"
+#include "perf-counters.hpp"
+#include "synthetic-source.hpp"
+#include "canned-bitstreams.hpp"
+#include "fake-encoder.hpp"
+#include "png-decoder.hpp"
+#include "frame-directory.hpp"
+#include "folder-watcher.hpp"
+#include "frame-reader.hpp"
+#include "frame-cache.hpp"
+#include "disk-frame-cache.hpp"
+#include "frame-preview.hpp"
+#include "report-writer.hpp"
+#include "streaming-statistics.hpp"
+#include "frame-metrics.hpp"
+#include "worker-pool.hpp"
+#include "roi-metrics.hpp"
 
 #include <vpx/vpx_decoder.h>
 #include <vpx/vp8dx.h>
 #include <wels/codec_api.h>
 #include <libyuv.h>
-#include <X11/Xlib.h>
 
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
-#include <filesystem>
+#include <deque>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 
 int32_t main(int32_t argc, char **argv) {
@@ -43,13 +66,25 @@ int32_t main(int32_t argc, char **argv) {
         commandlineArguments.count("crop.width") +
         commandlineArguments.count("crop.height")
     };
-  if ( (0 == commandlineArguments.count("folder")) ||
+  if ( ((0 == commandlineArguments.count("folder")) && (0 == commandlineArguments.count("synthetic"))) ||
        (0 == commandlineArguments.count("name")) ||
        ( (0 != cropCounter) && (4 != cropCounter) ) ||
        (0 == commandlineArguments.count("cid")) ) {
     std::cerr << argv[0] << " 'replays' a sequence of *.png files into i420 frames and waits for an ImageReading response before next frame." << std::endl;
     std::cerr << "Usage:   " << argv[0] << " --folder=<Folder with *.png files to replay> [--verbose]" << std::endl;
     std::cerr << "         --folder:          path to a folder with .png files" << std::endl;
+    std::cerr << "         --watch:           keep running and replay new .png files as they land in --folder" << std::endl;
+    std::cerr << "         --sweep:           keep running and replay the folder again for every opendlv.system.SystemOperationState with code 1; its description labels the run" << std::endl;
+    std::cerr << "         --cache.mb:        keep up to this many MB of converted i420 frames in memory for repeated replays; default: 0 (off)" << std::endl;
+    std::cerr << "         --diskcache:       keep converted i420 frames in this folder to map them instead of decoding in later runs" << std::endl;
+    std::cerr << "         --diskcache.mb:    maximum size of --diskcache in MB; least recently used frames are removed; default: 4096" << std::endl;
+    std::cerr << "         --diskcache.fullhash: identify .png files by their contents instead of name, size, and modification time" << std::endl;
+    std::cerr << "         --manifest:        cache the sorted list of .png files in this file and reuse it while the folder is unchanged" << std::endl;
+    std::cerr << "         --synthetic:       replay generated frames instead of .png files: noise, gradient, or moving" << std::endl;
+    std::cerr << "         --synthetic.width: width of the generated frames; default: 640" << std::endl;
+    std::cerr << "         --synthetic.height: height of the generated frames; default: 480" << std::endl;
+    std::cerr << "         --synthetic.frames: number of generated frames; default: 300" << std::endl;
+    std::cerr << "         --fakeencoder:     reply to every frame with canned VP80, VP90, or h264 frames from an internal thread" << std::endl;
     std::cerr << "         --crop.x:          crop this area from the input image (x for top left)" << std::endl;
     std::cerr << "         --crop.y:          crop this area from the input image (y for top left)" << std::endl;
     std::cerr << "         --crop.width:      crop this area from the input image (width)" << std::endl;
@@ -63,35 +98,137 @@ int32_t main(int32_t argc, char **argv) {
     std::cerr << "         --stopafter:       process only the first n frames (n > 0); default: 0 (process all)" << std::endl;
     std::cerr << "         --savepng:         flag to store decoded lossy frames as .png; default: false" << std::endl;
     std::cerr << "         --report:          name of the file for the report" << std::endl;
+    std::cerr << "         --report.format:   text or binary (columnar, see report-writer.hpp); default: text" << std::endl;
+    std::cerr << "         --metrics:         comma-separated metrics per frame: psnr, ssim, msssim, temporal; default: psnr,ssim" << std::endl;
+    std::cerr << "         --metrics.threads: threads computing the metrics including the main loop; default: 4 or number of CPUs if less" << std::endl;
+    std::cerr << "         --nofastpath:      compute the metrics also for results equal to their source or repeating the previous pair" << std::endl;
+    std::cerr << "         --roi:             region x,y,w,h[,weight] to compute PSNR and SSIM of separately; repeatable" << std::endl;
+    std::cerr << "         --fps:             frame rate of the replayed sequence to summarize the bitrate in kbps; default: 0 (no bitrate)" << std::endl;
+    std::cerr << "         --ignorecrc:       skip CRC and Adler-32 verification when decoding .png files from a trusted corpus" << std::endl;
+    std::cerr << "         --ingest:          read .png files with io_uring or pread; default: io_uring if available" << std::endl;
+    std::cerr << "         --ingest.depth:    number of .png files read ahead; default: 8" << std::endl;
+    std::cerr << "         --ingest.direct:   read .png files with O_DIRECT, bypassing the page cache" << std::endl;
+    std::cerr << "         --hugepages:       back the internal frame buffers with huge pages if available" << std::endl;
+    std::cerr << "         --shm.hugepages:   advise transparent huge pages for the shared i420 frame" << std::endl;
+    std::cerr << "         --shm.numanode:    bind the shared i420 frame to this NUMA node" << std::endl;
+    std::cerr << "         --shm.prefault:    fault in all pages of the shared i420 frame before replaying" << std::endl;
+    std::cerr << "         --cpu.feeder:      CPUs for the main loop as list (0-3,6) or mask (0xf); default: any" << std::endl;
+    std::cerr << "         --cpu.receiver:    CPUs for the threads of the OD4Session; default: any" << std::endl;
+    std::cerr << "         --cpu.workers:     CPUs for metrics worker threads; default: any" << std::endl;
+    std::cerr << "         --cpu.priority:    run all threads with SCHED_FIFO at this priority (1..99); default: 0 (off)" << std::endl;
+    std::cerr << "         --trace:           write a timeline of all processing stages per frame in Chrome trace-event JSON to this file" << std::endl;
+    std::cerr << "         --perf:            sample hardware performance counters per processing stage and summarize them at the end" << std::endl;
     std::cerr << "         --verbose:         sourceFrameDisplay PNG frame while replaying" << std::endl;
+    std::cerr << "         --heatmap:         with --verbose, show where the result differs from the source: absdiff or ssim" << std::endl;
+    std::cerr << "         --heatmap.fps:     maximum rate of the heatmap; default: 5" << std::endl;
     std::cerr << "Example: " << argv[0] << " --folder=. --verbose" << std::endl;
     retCode = 1;
   } else {
     const std::string folderWithPNGs{commandlineArguments["folder"]};
+    const bool WATCH{commandlineArguments.count("watch") != 0};
+    const bool SWEEP{commandlineArguments.count("sweep") != 0};
+    const uint32_t CACHE_MB{(commandlineArguments["cache.mb"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["cache.mb"])) : 0};
+    const std::string DISK_CACHE{commandlineArguments["diskcache"]};
+    const uint32_t DISK_CACHE_MB{(commandlineArguments["diskcache.mb"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["diskcache.mb"])) : 4096};
+    const bool DISK_CACHE_FULL_HASH{commandlineArguments.count("diskcache.fullhash") != 0};
+    const std::string MANIFEST{commandlineArguments["manifest"]};
+    const std::string SYNTHETIC{commandlineArguments["synthetic"]};
+    const uint32_t SYNTHETIC_WIDTH{(commandlineArguments["synthetic.width"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["synthetic.width"])) : 640};
+    const uint32_t SYNTHETIC_HEIGHT{(commandlineArguments["synthetic.height"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["synthetic.height"])) : 480};
+    const uint32_t SYNTHETIC_FRAMES{(commandlineArguments["synthetic.frames"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["synthetic.frames"])) : 300};
+    const std::string FAKE_ENCODER{commandlineArguments["fakeencoder"]};
+    ffe::SyntheticSource::Pattern syntheticPattern{ffe::SyntheticSource::Pattern::MOVING};
+    if (!SYNTHETIC.empty() && !ffe::SyntheticSource::parse(SYNTHETIC, syntheticPattern)) {
+      std::cerr << "[frame-feed-evaluator]: Unknown synthetic pattern '" << SYNTHETIC << "'." << std::endl;
+      return retCode;
+    }
+    const ffe::SyntheticSource syntheticSource{syntheticPattern};
     const uint32_t CROP_X{(commandlineArguments.count("crop.x") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.x"])) : 0};
     const uint32_t CROP_Y{(commandlineArguments.count("crop.y") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.y"])) : 0};
     const uint32_t CROP_WIDTH{(commandlineArguments.count("crop.width") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.width"])) : 0};
     const uint32_t CROP_HEIGHT{(commandlineArguments.count("crop.height") != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["crop.height"])) : 0};
     const std::string REPORT{commandlineArguments["report"]};
+    ffe::ReportWriter::Format reportFormat{ffe::ReportWriter::Format::TEXT};
+    if ((commandlineArguments.count("report.format") != 0) && !ffe::ReportWriter::parse(commandlineArguments["report.format"], reportFormat)) {
+      std::cerr << "[frame-feed-evaluator]: Unknown report format '" << commandlineArguments["report.format"] << "'." << std::endl;
+      return retCode;
+    }
+    uint32_t metrics{ffe::FrameMetrics::METRIC_PSNR | ffe::FrameMetrics::METRIC_SSIM};
+    if ((commandlineArguments.count("metrics") != 0) && !ffe::FrameMetrics::parse(commandlineArguments["metrics"], metrics)) {
+      std::cerr << "[frame-feed-evaluator]: Unknown metrics '" << commandlineArguments["metrics"] << "'." << std::endl;
+      return retCode;
+    }
+    const bool METRIC_PSNR{0 != (metrics & ffe::FrameMetrics::METRIC_PSNR)};
+    const bool METRIC_SSIM{0 != (metrics & ffe::FrameMetrics::METRIC_SSIM)};
+    const bool METRIC_MSSSIM{0 != (metrics & ffe::FrameMetrics::METRIC_MSSSIM)};
+    const bool METRIC_TEMPORAL{0 != (metrics & ffe::FrameMetrics::METRIC_TEMPORAL)};
+    const uint32_t METRICS_THREADS{(commandlineArguments["metrics.threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["metrics.threads"])) :
+                                   std::max(1u, std::min(4u, std::thread::hardware_concurrency()))};
+    const bool FAST_PATH{commandlineArguments.count("nofastpath") == 0};
+    // Regions of interest; cluon keeps only the last of repeated arguments.
+    std::vector<ffe::Roi> rois;
+    for (int32_t i{1}; i < argc; i++) {
+      const std::string ARG{argv[i]};
+      if (0 == ARG.rfind("--roi=", 0)) {
+        ffe::Roi roi;
+        if (!ffe::RoiMetrics::parse(ARG.substr(6), roi)) {
+          std::cerr << "[frame-feed-evaluator]: Invalid region of interest '" << ARG.substr(6) << "'." << std::endl;
+          return retCode;
+        }
+        if (ffe::RoiMetrics::align(roi)) {
+          std::cerr << "[frame-feed-evaluator]: Region of interest '" << ARG.substr(6) << "' moved to even coordinates " << roi.x << "," << roi.y << "." << std::endl;
+        }
+        rois.push_back(roi);
+      }
+    }
+    const double FPS{(commandlineArguments["fps"].size() != 0) ? std::stod(commandlineArguments["fps"]) : 0.0};
+    const std::string TRACE{commandlineArguments["trace"]};
     const std::string NAME{commandlineArguments["name"]};
     const uint32_t DELAY_START{(commandlineArguments["delay.start"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["delay.start"])) : 5000};
     const uint32_t DELAY{(commandlineArguments["delay"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["delay"])) : 1000};
     const uint32_t TIMEOUT{(commandlineArguments["timeout"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["timeout"])) : 40};
     const bool VERBOSE{commandlineArguments.count("verbose") != 0};
+    ffe::DifferenceMap::Mode heatmap{ffe::DifferenceMap::Mode::OFF};
+    if ((commandlineArguments.count("heatmap") != 0) && !ffe::DifferenceMap::parse(commandlineArguments["heatmap"], heatmap)) {
+      std::cerr << "[frame-feed-evaluator]: Unknown heatmap '" << commandlineArguments["heatmap"] << "'." << std::endl;
+      return retCode;
+    }
+    const uint32_t HEATMAP_FPS{(commandlineArguments["heatmap.fps"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["heatmap.fps"])) : 5};
     const bool EXIT_ON_TIMEOUT{commandlineArguments.count("noexitontimeout") == 0};
     const uint32_t STOPAFTER{(commandlineArguments["stopafter"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["stopafter"])) : 0};
     const bool SAVE_PNG{commandlineArguments.count("savepng") == 0};
-
-    // Show frames.
-    Display *sourceFrameDisplay{nullptr};
-    Visual *sourceFrameVisual{nullptr};
-    Window sourceFrameWindow{0};
-    XImage *sourceFrameXImage{nullptr};
-
-    Display *resultingFrameDisplay{nullptr};
-    Visual *resultingFrameVisual{nullptr};
-    Window resultingFrameWindow{0};
-    XImage *resultingFrameXImage{nullptr};
+    const bool IGNORE_CRC{commandlineArguments.count("ignorecrc") != 0};
+    const bool INGEST_IO_URING{commandlineArguments["ingest"] != "pread"};
+    const uint32_t INGEST_DEPTH{(commandlineArguments["ingest.depth"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["ingest.depth"])) : 8};
+    const bool INGEST_DIRECT{commandlineArguments.count("ingest.direct") != 0};
+    const bool USE_HUGEPAGES{commandlineArguments.count("hugepages") != 0};
+    const bool PERF{commandlineArguments.count("perf") != 0};
+    ffe::ThreadPlacement feederPlacement, receiverPlacement, workersPlacement;
+    {
+      const int32_t PRIORITY{(commandlineArguments["cpu.priority"].size() != 0) ? std::stoi(commandlineArguments["cpu.priority"]) : 0};
+      feederPlacement.priority = receiverPlacement.priority = workersPlacement.priority = PRIORITY;
+      for (auto p : {std::make_pair("cpu.feeder", &feederPlacement), std::make_pair("cpu.receiver", &receiverPlacement), std::make_pair("cpu.workers", &workersPlacement)}) {
+        if (0 != commandlineArguments.count(p.first)) {
+          p.second->hasCpus = ffe::parseCpuSet(commandlineArguments[p.first], p.second->cpus);
+          if (!p.second->hasCpus) {
+            std::cerr << "[frame-feed-evaluator]: Ignoring invalid CPU set '" << commandlineArguments[p.first] << "' for --" << p.first << "." << std::endl;
+          }
+        }
+      }
+      // The feeder is placed after the receiver; hence, it needs to restore
+      // the original CPU set if only the receiver was placed explicitly.
+      if (receiverPlacement.hasCpus && !feederPlacement.hasCpus) {
+        feederPlacement.hasCpus = (0 == ::pthread_getaffinity_np(::pthread_self(), sizeof(cpu_set_t), &feederPlacement.cpus));
+      }
+      // Likewise, the workers are started by the placed feeder.
+      if ((receiverPlacement.hasCpus || feederPlacement.hasCpus) && !workersPlacement.hasCpus) {
+        workersPlacement.hasCpus = (0 == ::pthread_getaffinity_np(::pthread_self(), sizeof(cpu_set_t), &workersPlacement.cpus));
+      }
+    }
+    ffe::SharedMemoryTuning sharedMemoryTuning;
+    sharedMemoryTuning.hugePages = (commandlineArguments.count("shm.hugepages") != 0);
+    sharedMemoryTuning.numaNode = (commandlineArguments["shm.numanode"].size() != 0) ? std::stoi(commandlineArguments["shm.numanode"]) : -1;
+    sharedMemoryTuning.prefault = (commandlineArguments.count("shm.prefault") != 0);
 
     // openh264 openh264Decoder.
     ISVCDecoder *openh264Decoder{nullptr};
@@ -119,73 +256,534 @@ int32_t main(int32_t argc, char **argv) {
     bool vpxCodecInitialized{false};
     vpx_codec_ctx_t codec;
 
-    // Frame data.
-    std::vector<unsigned char> rawABGRFromPNG;
-    std::vector<unsigned char> rawARGBFrame;
-    std::vector<unsigned char> tempImageBuffer;
+    // Frame data; all intermediate frames are recycled from fixed-geometry pools.
+    ffe::PngDecoder pngDecoder{IGNORE_CRC};
+    ffe::FrameReader frameReader{INGEST_DEPTH, INGEST_IO_URING, INGEST_DIRECT};
     std::unique_ptr<cluon::SharedMemory> sharedMemoryFori420{nullptr};
-    std::vector<unsigned char> resultingI420Frame;
-    std::vector<unsigned char> resultingRawARGBFrame;
+    std::unique_ptr<ffe::FrameBufferPool> sourceI420Pool{nullptr};
+    std::unique_ptr<ffe::FrameBufferPool> finalI420Pool{nullptr};
+    std::unique_ptr<ffe::FrameBufferPool> finalABGRPool{nullptr};
+    // Declared after the shared memory so that it detaches first.
+    std::unique_ptr<ffe::FakeEncoder> fakeEncoder{nullptr};
+    // Shows frames from its own thread.
+    std::unique_ptr<ffe::FramePreview> framePreview{nullptr};
 
+    // Trace recorder; declared before the OD4Session so that it outlives its threads and writes the trace on any exit.
+    std::unique_ptr<ffe::TraceRecorder> traceRecorder{TRACE.empty() ? nullptr : new ffe::TraceRecorder{TRACE}};
+    if (traceRecorder) {
+      traceRecorder->nameCurrentThread("feeder");
+    }
+    std::atomic<uint32_t> frameInFlight{0};
+
+    // Threads created by the OD4Session inherit the placement of this thread.
+    if (!ffe::applyToCurrentThread(receiverPlacement)) {
+      std::cerr << "[frame-feed-evaluator]: Failed to apply CPU placement " << ffe::toString(receiverPlacement) << " for receiver." << std::endl;
+    }
     cluon::OD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))};
+    if (!ffe::applyToCurrentThread(feederPlacement)) {
+      std::cerr << "[frame-feed-evaluator]: Failed to apply CPU placement " << ffe::toString(feederPlacement) << " for feeder." << std::endl;
+    }
     if (od4.isRunning()) {
       cluon::data::TimeStamp before, after;
       std::atomic<bool> hasReceivedImageReading{false};
       opendlv::proxy::ImageReading imageReading;
-      od4.dataTrigger(opendlv::proxy::ImageReading::ID(), [&hasReceivedImageReading, &imageReading, &after](cluon::data::Envelope &&env){
+      od4.dataTrigger(opendlv::proxy::ImageReading::ID(), [&hasReceivedImageReading, &imageReading, &after, &frameInFlight, trace = traceRecorder.get()](cluon::data::Envelope &&env){
         if (opendlv::proxy::ImageReading::ID() == env.dataType()) {
           after = env.sent();
           imageReading = cluon::extractMessage<opendlv::proxy::ImageReading>(std::move(env));
           hasReceivedImageReading.store(true);
+          if (nullptr != trace) {
+            trace->nameCurrentThread("receiver");
+            trace->instant("receive", frameInFlight.load());
+          }
         }
       });
 
-      std::unique_ptr<std::fstream> reportFile{nullptr};
+      // With --sweep, every SystemOperationState with code 1 requests another
+      // replay, e.g., once an encoder with the next setting is running.
+      constexpr int32_t SWEEP_RUN_REQUEST{1};
+      std::mutex runRequestsMutex;
+      std::deque<std::string> runRequests;
+      if (SWEEP) {
+        od4.dataTrigger(opendlv::system::SystemOperationState::ID(), [&runRequestsMutex, &runRequests](cluon::data::Envelope &&env){
+          auto request = cluon::extractMessage<opendlv::system::SystemOperationState>(std::move(env));
+          if (SWEEP_RUN_REQUEST == request.code()) {
+            std::lock_guard<std::mutex> lck(runRequestsMutex);
+            runRequests.push_back(request.description());
+          }
+        });
+      }
+
+      // Columns of the per-frame rows; the text report names only some values
+      // and only the selected metrics have columns.
+      using Type = ffe::ReportColumn::Type;
+      const std::vector<ffe::ReportColumn> REPORT_COLUMNS{[&]() {
+        std::vector<ffe::ReportColumn> columns{
+          {"filename", Type::STRING, false}, {"crop.x", Type::INTEGER, false}, {"crop.y", Type::INTEGER, false},
+          {"width", Type::INTEGER, false}, {"height", Type::INTEGER, false}, {"size[bytes]", Type::INTEGER, true}};
+        if (METRIC_PSNR) {
+          columns.push_back({"PSNR", Type::REAL, true});
+        }
+        if (METRIC_SSIM) {
+          columns.push_back({"SSIM", Type::REAL, true});
+        }
+        columns.push_back({"duration[microseconds]", Type::INTEGER, true});
+        if (METRIC_PSNR) {
+          columns.insert(columns.end(), {{"PSNR.Y", Type::REAL, true}, {"PSNR.U", Type::REAL, true}, {"PSNR.V", Type::REAL, true}, {"PSNR.611", Type::REAL, true}});
+        }
+        if (METRIC_SSIM) {
+          columns.insert(columns.end(), {{"SSIM.Y", Type::REAL, true}, {"SSIM.U", Type::REAL, true}, {"SSIM.V", Type::REAL, true}});
+        }
+        if (METRIC_PSNR) {
+          columns.insert(columns.end(), {{"MSE.Y", Type::REAL, true}, {"MSE.U", Type::REAL, true}, {"MSE.V", Type::REAL, true}});
+        }
+        if (METRIC_MSSSIM) {
+          columns.push_back({"MS-SSIM", Type::REAL, true});
+        }
+        if (METRIC_TEMPORAL) {
+          columns.insert(columns.end(), {{"tPSNR", Type::REAL, true}, {"flicker", Type::REAL, true}, {"frozen.blocks", Type::REAL, true},
+                                         {"frozen", Type::INTEGER, true}, {"duplicated", Type::INTEGER, true}});
+        }
+        for (std::size_t i{0}; i < rois.size(); i++) {
+          const std::string PREFIX{"roi" + std::to_string(i)};
+          columns.insert(columns.end(), {{PREFIX + ".PSNR", Type::REAL, true}, {PREFIX + ".SSIM", Type::REAL, true}});
+        }
+        if (1 < rois.size()) {
+          columns.insert(columns.end(), {{"roi.PSNR", Type::REAL, true}, {"roi.SSIM", Type::REAL, true}});
+        }
+        return columns;
+      }()};
+      ffe::ReportRow reportRow;
+      ffe::WorkerPool metricsWorkers{METRICS_THREADS, workersPlacement};
+      ffe::FrameMetrics frameMetrics{metrics, &metricsWorkers, FAST_PATH};
+      ffe::RoiMetrics roiMetrics{rois, &metricsWorkers};
+      std::unique_ptr<ffe::ReportWriter> reportWriter{nullptr};
       if (!REPORT.empty()) {
-        reportFile.reset(new std::fstream(REPORT.c_str(), std::ios::trunc|std::ios::out));
-        if (!(reportFile && reportFile->good())) {
-          reportFile = nullptr;
+        reportWriter.reset(new ffe::ReportWriter{REPORT, reportFormat, REPORT_COLUMNS});
+        if (!reportWriter->valid()) {
+          std::cerr << "[frame-feed-evaluator]: Could not create report '" << REPORT << "'." << std::endl;
+          reportWriter = nullptr;
+        }
+      }
+
+      // Hardware performance counters for the main loop; opened after the
+      // feeder placement was applied as they are bound to this thread. The
+      // metric workers run only while this thread waits in the metrics stage;
+      // hence, their counters are added.
+      std::unique_ptr<ffe::PerfCounters> perfCounters{PERF ? new ffe::PerfCounters{} : nullptr};
+      if (perfCounters && !perfCounters->valid()) {
+        std::cerr << "[frame-feed-evaluator]: Hardware performance counters unavailable: " << perfCounters->error() << std::endl;
+      }
+      if (perfCounters && perfCounters->valid()) {
+        for (pid_t tid : metricsWorkers.threadIds()) {
+          if (!perfCounters->attach(tid)) {
+            std::cerr << "[frame-feed-evaluator]: Hardware performance counters do not cover all metric workers (" << perfCounters->error() << "); the metrics stage is incomplete." << std::endl;
+            perfCounters->incomplete("metrics");
+            break;
+          }
+        }
+      }
+
+      // Describe the run so that results can be reproduced.
+      {
+        std::stringstream sstr;
+        sstr << "# frame-feed-evaluator: cpu.feeder;" << ffe::toString(feederPlacement)
+             << ";cpu.receiver;" << ffe::toString(receiverPlacement)
+             << ";cpu.workers;" << ffe::toString(workersPlacement)
+             << ";metrics.threads;" << metricsWorkers.size()
+             << ";png.inflate;" << pngDecoder.inflateBackend()
+             << ";png.ignorecrc;" << IGNORE_CRC
+             << ";ingest;" << frameReader.backend()
+             << ";ingest.depth;" << INGEST_DEPTH
+             << ";ingest.direct;" << INGEST_DIRECT;
+        const std::string str = sstr.str();
+        std::clog << str << std::endl;
+        if (reportWriter) {
+          reportWriter->text(str);
         }
       }
 
       // Sort file entries.
       std::vector<std::string> entries;
-      for (const auto &entry : std::filesystem::directory_iterator(folderWithPNGs)) {
-        std::string filename{entry.path()};
-        if (std::string::npos != filename.find(".png")) {
-          entries.push_back(filename);
+      std::unique_ptr<ffe::FolderWatcher> folderWatcher{nullptr};
+      std::unique_ptr<ffe::FrameCache> frameCache{nullptr};
+      std::unique_ptr<ffe::DiskFrameCache> diskFrameCache{nullptr};
+      if (!SYNTHETIC.empty()) {
+        for (uint32_t i{0}; i < SYNTHETIC_FRAMES; i++) {
+          entries.push_back("synthetic-" + SYNTHETIC + "-" + std::to_string(i));
+        }
+      }
+      else {
+        // Watch before listing so that no frame landing in between is missed.
+        if (WATCH) {
+          folderWatcher.reset(new ffe::FolderWatcher{folderWithPNGs, ".png"});
+          if (!folderWatcher->valid()) {
+            std::cerr << "[frame-feed-evaluator]: Could not watch folder '" << folderWithPNGs << "'." << std::endl;
+            return retCode;
+          }
+        }
+        bool fromManifest{false};
+        if (!ffe::listFrames(folderWithPNGs, ".png", MANIFEST, entries, fromManifest)) {
+          std::cerr << "[frame-feed-evaluator]: Could not read folder '" << folderWithPNGs << "'." << std::endl;
+          return retCode;
+        }
+        if (VERBOSE) {
+          std::clog << "[frame-feed-evaluator]: Found " << entries.size() << " .png files" << (fromManifest ? " in manifest '" + MANIFEST + "'." : ".") << std::endl;
+        }
+        if (folderWatcher) {
+          folderWatcher->listed(entries);
         }
       }
-      std::sort(entries.begin(), entries.end());
 
       uint32_t width{0}, height{0};
+      uint32_t sourceWidth{0}, sourceHeight{0};
       uint32_t finalWidth{CROP_WIDTH}, finalHeight{CROP_HEIGHT};
       uint32_t entryCounter{0};
-      for (const auto &entry : entries) {
-        entryCounter++;
-        std::string filename{entry};
-        if (VERBOSE) {
-          std::clog << "[frame-feed-evaluator]: Processing " << entryCounter << "/" << entries.size() << ": '"  << filename << "'." << std::endl;
+
+      // Throughput of the evaluator from the first published frame on.
+      uint32_t framesEvaluated{0};
+      int64_t minimumLatency{std::numeric_limits<int64_t>::max()};
+      // Time spent waiting for and holding the lock of the shared memory per frame.
+      uint32_t framesPublished{0};
+      std::chrono::nanoseconds lockWaitTotal{0}, lockHoldTotal{0}, lockHoldMaximum{0};
+      cluon::data::TimeStamp firstPublished;
+      // Distribution of the per-frame results; SIGUSR1 reports them mid-run.
+      ffe::StreamingStatistics psnrStatistics, ssimStatistics{true}, msssimStatistics{true}, sizeStatistics, durationStatistics;
+      ffe::StreamingStatistics temporalPsnrStatistics, flickerStatistics;
+      ffe::StreamingStatistics roiPsnrStatistics, roiSsimStatistics{true};
+      uint32_t framesFrozen{0}, framesDuplicated{0};
+      // Frames whose metrics were not computed.
+      uint32_t framesIdentical{0}, framesRepeated{0};
+      // Previous frames of source and result for temporal metrics.
+      ffe::FrameBufferHandle previousSourceFrame, previousResultFrame;
+      uint64_t bytesEvaluated{0};
+      // Sequence PSNR per plane from the summed squared errors.
+      uint64_t sseEvaluated[3]{0, 0, 0}, samplesEvaluated[3]{0, 0, 0};
+      ffe::SummaryRequest &summaryRequest{ffe::SummaryRequest::instance()};
+      auto reportSummary = [&]() {
+        std::vector<std::string> lines;
+        if (METRIC_PSNR) {
+          lines.push_back("# frame-feed-evaluator: summary;PSNR;" + psnrStatistics.toString());
         }
+        if (METRIC_SSIM) {
+          lines.push_back("# frame-feed-evaluator: summary;SSIM;" + ssimStatistics.toString());
+        }
+        if (METRIC_MSSSIM) {
+          lines.push_back("# frame-feed-evaluator: summary;MS-SSIM;" + msssimStatistics.toString());
+        }
+        if (METRIC_TEMPORAL) {
+          lines.push_back("# frame-feed-evaluator: summary;tPSNR;" + temporalPsnrStatistics.toString());
+          lines.push_back("# frame-feed-evaluator: summary;flicker;" + flickerStatistics.toString());
+          lines.push_back("# frame-feed-evaluator: summary;temporal;frozen;" + std::to_string(framesFrozen) + ";duplicated;" + std::to_string(framesDuplicated));
+        }
+        if (0 < roiMetrics.size()) {
+          lines.push_back("# frame-feed-evaluator: summary;roi.PSNR;" + roiPsnrStatistics.toString());
+          lines.push_back("# frame-feed-evaluator: summary;roi.SSIM;" + roiSsimStatistics.toString());
+        }
+        if (FAST_PATH) {
+          lines.push_back("# frame-feed-evaluator: summary;fastpath;identical;" + std::to_string(framesIdentical) + ";repeated;" + std::to_string(framesRepeated));
+        }
+        lines.push_back("# frame-feed-evaluator: summary;size[bytes];" + sizeStatistics.toString());
+        lines.push_back("# frame-feed-evaluator: summary;duration[microseconds];" + durationStatistics.toString());
+        std::stringstream sstr;
+        sstr << "# frame-feed-evaluator: summary;bitrate;frames;" << framesEvaluated << ";bytes;" << bytesEvaluated;
+        if ((0 < FPS) && (0 < framesEvaluated)) {
+          sstr << ";fps;" << FPS << ";kbps;" << static_cast<double>(bytesEvaluated) * 8.0 * FPS / framesEvaluated / 1000.0;
+        }
+        lines.push_back(sstr.str());
+        if (METRIC_PSNR) {
+          sstr.str("");
+          sstr << "# frame-feed-evaluator: summary;global";
+          for (uint32_t i{0}; i < 3; i++) {
+            sstr << ";PSNR." << "YUV"[i] << ';' << ffe::FrameMetrics::psnr(sseEvaluated[i], samplesEvaluated[i]);
+          }
+          sstr << ";PSNR;" << ffe::FrameMetrics::psnr(sseEvaluated[0] + sseEvaluated[1] + sseEvaluated[2],
+                                                      samplesEvaluated[0] + samplesEvaluated[1] + samplesEvaluated[2]);
+          lines.push_back(sstr.str());
+        }
+        for (const auto &str : lines) {
+          std::clog << str << std::endl;
+          if (reportWriter) {
+            reportWriter->text(str);
+          }
+        }
+      };
+      auto reportThroughput = [&]() {
+        const double SECONDS{static_cast<double>(cluon::time::deltaInMicroseconds(cluon::time::now(), firstPublished)) / 1000.0 / 1000.0};
+        std::stringstream sstr;
+        sstr << "# frame-feed-evaluator: throughput;frames;" << framesEvaluated << ";seconds;" << SECONDS
+             << ";fps;" << (0 < SECONDS ? framesEvaluated / SECONDS : 0.0)
+             << ";minimum duration[microseconds];" << minimumLatency;
+        if (0 < framesPublished) {
+          using microseconds = std::chrono::duration<double, std::micro>;
+          sstr << ";lock.wait.mean[microseconds];" << microseconds(lockWaitTotal).count() / framesPublished
+               << ";lock.hold.mean[microseconds];" << microseconds(lockHoldTotal).count() / framesPublished
+               << ";lock.hold.max[microseconds];" << microseconds(lockHoldMaximum).count();
+        }
+        if (folderWatcher) {
+          sstr << ";watch.skipped;" << folderWatcher->skipped() << ";watch.overflows;" << folderWatcher->overflows();
+        }
+        if (frameCache) {
+          sstr << ";cache.frames;" << frameCache->size() << ";cache.hits;" << frameCache->hits()
+               << ";cache.misses;" << frameCache->misses() << ";cache.evictions;" << frameCache->evictions();
+        }
+        if (framePreview) {
+          sstr << ";preview.shown;" << framePreview->shown() << ";preview.dropped;" << framePreview->dropped();
+        }
+        if (diskFrameCache) {
+          sstr << ";diskcache.hits;" << diskFrameCache->hits() << ";diskcache.misses;" << diskFrameCache->misses()
+               << ";diskcache.stores;" << diskFrameCache->stores() << ";diskcache.evictions;" << diskFrameCache->evictions();
+        }
+        const std::string str = sstr.str();
+        std::clog << str << std::endl;
+        if (reportWriter) {
+          reportWriter->text(str);
+        }
+      };
 
-        // Reset raw buffer for PNG.
-        rawABGRFromPNG.clear();
-        unsigned lodePNGRetVal = lodepng::decode(rawABGRFromPNG, width, height, filename.c_str());
-        if (0 == lodePNGRetVal) {
-          rawARGBFrame.reserve(rawABGRFromPNG.size());
-          resultingRawARGBFrame.reserve(rawABGRFromPNG.size());
+      // With --watch, frames landing after the initial listing follow; the
+      // running throughput is reported periodically as there is no end.
+      constexpr int64_t WATCH_REPORT_INTERVAL{10 * 1000 * 1000};
+      cluon::data::TimeStamp lastReport{cluon::time::now()};
+      std::size_t nextEntry{0}, nextRead{0};
+      uint32_t run{1}, runStart{0};
+      std::string filename;
+      while (true) {
+        if (folderWatcher && (0 < framesEvaluated) && (WATCH_REPORT_INTERVAL <= cluon::time::deltaInMicroseconds(cluon::time::now(), lastReport))) {
+          reportThroughput();
+          lastReport = cluon::time::now();
+        }
+        if (summaryRequest.isRequested.exchange(false) && (0 < framesEvaluated)) {
+          reportThroughput();
+          reportSummary();
+        }
 
+        // Keep the reads of the upcoming frames in flight; frames held in the
+        // cache are not read again, nor are those on disk unless they are
+        // identified by their contents.
+        while (SYNTHETIC.empty() && (nextRead < entries.size()) && (nextRead < nextEntry + INGEST_DEPTH)) {
+          if (frameCache && frameCache->contains(ffe::FrameCache::key(entries[nextRead], CROP_X, CROP_Y))) {
+            nextRead++;
+          }
+          else if (diskFrameCache && !DISK_CACHE_FULL_HASH &&
+                   diskFrameCache->contains(diskFrameCache->key(entries[nextRead], nullptr, 0, CROP_X, CROP_Y))) {
+            nextRead++;
+          }
+          else if (frameReader.submit(entries[nextRead])) {
+            nextRead++;
+          }
+          else {
+            break;
+          }
+        }
+        if (nextEntry < entries.size()) {
+          filename = entries[nextEntry++];
+        }
+        else if (folderWatcher && folderWatcher->valid() && !cluon::TerminateHandler::instance().isTerminated.load()) {
+          // Frames landing while watching are read when they are replayed;
+          // while the folder is idle, the periodic reports above continue.
+          if (!folderWatcher->next(filename)) {
+            continue;
+          }
+        }
+        else if (SWEEP) {
+          // Summarize this run and wait for the request of the next one.
+          if (0 < framesEvaluated) {
+            reportThroughput();
+            reportSummary();
+          }
+          std::string label;
+          bool requested{false};
+          while (!requested && !cluon::TerminateHandler::instance().isTerminated.load()) {
+            {
+              std::lock_guard<std::mutex> lck(runRequestsMutex);
+              if (!runRequests.empty()) {
+                label = runRequests.front();
+                runRequests.pop_front();
+                requested = true;
+              }
+            }
+            if (summaryRequest.isRequested.exchange(false) && (0 < framesEvaluated)) {
+              reportThroughput();
+              reportSummary();
+            }
+            if (!requested) {
+              std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+          }
+          if (!requested) {
+            break;
+          }
+          run++;
+          runStart = entryCounter;
+          nextEntry = nextRead = 0;
+          framesEvaluated = 0;
+          minimumLatency = std::numeric_limits<int64_t>::max();
+          framesPublished = 0;
+          lockWaitTotal = lockHoldTotal = lockHoldMaximum = std::chrono::nanoseconds{0};
+          psnrStatistics.reset();
+          ssimStatistics.reset();
+          msssimStatistics.reset();
+          temporalPsnrStatistics.reset();
+          flickerStatistics.reset();
+          roiPsnrStatistics.reset();
+          roiSsimStatistics.reset();
+          framesFrozen = framesDuplicated = 0;
+          framesIdentical = framesRepeated = 0;
+          previousSourceFrame.reset();
+          previousResultFrame.reset();
+          sizeStatistics.reset();
+          durationStatistics.reset();
+          bytesEvaluated = 0;
+          sseEvaluated[0] = sseEvaluated[1] = sseEvaluated[2] = 0;
+          samplesEvaluated[0] = samplesEvaluated[1] = samplesEvaluated[2] = 0;
+          firstPublished = cluon::data::TimeStamp{};
+          const std::string str{"# frame-feed-evaluator: run;" + std::to_string(run) + ";label;" + label};
+          std::clog << str << std::endl;
+          if (reportWriter) {
+            reportWriter->text(str);
+          }
+          continue;
+        }
+        else {
+          break;
+        }
+        entryCounter++;
+        if (VERBOSE) {
+          std::clog << "[frame-feed-evaluator]: Processing " << entryCounter << "/" << (folderWatcher ? std::string{"-"} : std::to_string(entries.size())) << ": '"  << filename << "'." << std::endl;
+        }
+        unsigned lodePNGRetVal{0};
+        const ffe::FrameBuffer *cachedFrame{nullptr};
+        bool mappedFromDisk{false};
+        std::string diskKey;
+        const unsigned char *png{nullptr};
+        std::size_t pngSize{0};
+        {
+          ffe::TraceScope traceScope{traceRecorder.get(), "load", entryCounter};
+          const ffe::PerfSample perfBegin{ffe::perfBegin(perfCounters.get())};
+          if (!SYNTHETIC.empty()) {
+            // Synthetic frames are rendered straight into i420 during conversion.
+            width = SYNTHETIC_WIDTH;
+            height = SYNTHETIC_HEIGHT;
+          }
+          else {
+            // Only the header is parsed here; the image is decoded straight into
+            // i420 below unless it is in the cache from an earlier run.
+            const bool READ_AHEAD{(0 < frameReader.pending()) && (frameReader.front() == filename)};
+            const int READ_ERROR{READ_AHEAD ? frameReader.next(png, pngSize) : 0};
+            cachedFrame = frameCache ? frameCache->find(ffe::FrameCache::key(filename, CROP_X, CROP_Y), width, height) : nullptr;
+            // Full hashes identify frames on disk by their contents; hence,
+            // frames not read ahead (e.g., with --watch) are read right here.
+            const bool READ_NOW{!READ_AHEAD && (nullptr == cachedFrame) && diskFrameCache && DISK_CACHE_FULL_HASH};
+            const unsigned READ_NOW_ERROR{READ_NOW ? pngDecoder.read(filename, png, pngSize) : 0u};
+            if ((nullptr == cachedFrame) && diskFrameCache && (0 == READ_ERROR) && (0 == READ_NOW_ERROR)) {
+              diskKey = diskFrameCache->key(filename, png, pngSize, CROP_X, CROP_Y);
+              cachedFrame = diskFrameCache->find(diskKey, width, height);
+              mappedFromDisk = (nullptr != cachedFrame);
+            }
+            if (nullptr == cachedFrame) {
+              if (READ_AHEAD) {
+                lodePNGRetVal = (0 == READ_ERROR) ? pngDecoder.load(png, pngSize, width, height) : 78;
+              }
+              else if (READ_NOW) {
+                lodePNGRetVal = (0 == READ_NOW_ERROR) ? pngDecoder.load(png, pngSize, width, height) : READ_NOW_ERROR;
+              }
+              else {
+                lodePNGRetVal = pngDecoder.load(filename, width, height);
+              }
+            }
+          }
+          ffe::perfEnd(perfCounters.get(), "load", perfBegin);
+        }
+        if ((0 == lodePNGRetVal) && sharedMemoryFori420 &&
+            ((sourceWidth != width) || (sourceHeight != height))) {
+          std::cerr << "[frame-feed-evaluator]: Skipping '" << filename << "' as its size " << width << "x" << height << " differs from " << sourceWidth << "x" << sourceHeight << "." << std::endl;
+        }
+        else if (0 == lodePNGRetVal) {
           // Initialize output frame in i420 format.
           if (!sharedMemoryFori420) {
             if (0 == (finalWidth * finalHeight)) {
               finalWidth = width;
               finalHeight = height;
             }
+            sourceWidth = width;
+            sourceHeight = height;
+
+            // Synthetic frames are rendered at full size and cropped; PNG frames
+            // are decoded into the crop window directly.
+            if (!SYNTHETIC.empty()) {
+              sourceI420Pool.reset(new ffe::FrameBufferPool{ffe::PixelFormat::I420, width, height, 1, USE_HUGEPAGES});
+            }
+            // Temporal metrics keep the previous source and result.
+            finalI420Pool.reset(new ffe::FrameBufferPool{ffe::PixelFormat::I420, finalWidth, finalHeight, METRIC_TEMPORAL ? 4u : 2u, USE_HUGEPAGES});
+            if (!roiMetrics.clip(finalWidth, finalHeight)) {
+              std::cerr << "[frame-feed-evaluator]: Regions of interest outside of the " << finalWidth << "x" << finalHeight << " frames are ignored." << std::endl;
+            }
+            if (VERBOSE) {
+              framePreview.reset(new ffe::FramePreview{finalWidth, finalHeight, heatmap, HEATMAP_FPS});
+              if (framePreview->valid()) {
+                std::clog << "[frame-feed-evaluator]: Showing frames " << (framePreview->usesSharedMemory() ? "with" : "without") << " MIT-SHM." << std::endl;
+              }
+              else {
+                std::cerr << "[frame-feed-evaluator]: Could not open X11 display to show frames." << std::endl;
+                framePreview.reset();
+              }
+            }
+            if (SAVE_PNG) {
+              // lodepng expects tightly packed rows.
+              finalABGRPool.reset(new ffe::FrameBufferPool{ffe::PixelFormat::ARGB, finalWidth, finalHeight, 1, USE_HUGEPAGES, 1});
+            }
+            if (0 < CACHE_MB) {
+              // The cache lays out its frames like the pool of final frames.
+              const uint64_t FRAME_SIZE{finalI420Pool->bufferSize()};
+              const uint32_t CAPACITY{static_cast<uint32_t>(static_cast<uint64_t>(CACHE_MB) * 1024 * 1024 / FRAME_SIZE)};
+              if (0 == CAPACITY) {
+                std::cerr << "[frame-feed-evaluator]: " << CACHE_MB << " MB cannot cache a frame of " << FRAME_SIZE << " bytes; not caching frames." << std::endl;
+              }
+              else {
+                frameCache.reset(new ffe::FrameCache{finalWidth, finalHeight, CAPACITY, USE_HUGEPAGES});
+                if (VERBOSE) {
+                  std::clog << "[frame-feed-evaluator]: Caching up to " << CAPACITY << " converted frames." << std::endl;
+                }
+              }
+            }
+            if (!DISK_CACHE.empty()) {
+              diskFrameCache.reset(new ffe::DiskFrameCache{DISK_CACHE, static_cast<uint64_t>(DISK_CACHE_MB) * 1024 * 1024, finalWidth, finalHeight, DISK_CACHE_FULL_HASH});
+              if (!diskFrameCache->valid()) {
+                std::cerr << "[frame-feed-evaluator]: Could not use folder '" << DISK_CACHE << "' to cache frames." << std::endl;
+                return retCode;
+              }
+            }
+            if ((sourceI420Pool && !sourceI420Pool->valid()) || !finalI420Pool->valid() ||
+                (frameCache && !frameCache->valid()) ||
+                (finalABGRPool && !finalABGRPool->valid())) {
+              std::cerr << "[frame-feed-evaluator]: Failed to allocate frame buffers." << std::endl;
+              return retCode;
+            }
+            if (VERBOSE) {
+              std::clog << "[frame-feed-evaluator]: Allocated frame buffers " << (finalI420Pool->usesHugePages() ? "with" : "without") << " huge pages." << std::endl;
+            }
 
-            tempImageBuffer.reserve(width * height * 3/2);
             sharedMemoryFori420.reset(new cluon::SharedMemory{NAME, finalWidth * finalHeight * 3/2});
             std::clog << "[frame-feed-evaluator]: Created shared memory '" << NAME << "' of size " << sharedMemoryFori420->size() << " holding an i420 frame of size " << finalWidth << "x" << finalHeight << "." << std::endl;
-            resultingI420Frame.reserve(sharedMemoryFori420->size());
+            if (sharedMemoryTuning.hugePages || (0 <= sharedMemoryTuning.numaNode) || sharedMemoryTuning.prefault) {
+              auto applied = ffe::tuneSharedMemory(sharedMemoryFori420->data(), sharedMemoryFori420->size(), sharedMemoryTuning);
+              std::clog << "[frame-feed-evaluator]: Shared memory huge pages: " << (applied.hugePages ? "yes" : "no")
+                        << ", NUMA node: " << (applied.numaBound ? std::to_string(sharedMemoryTuning.numaNode) : "any")
+                        << ", prefaulted: " << (applied.prefaulted ? "yes" : "no") << "." << std::endl;
+            }
+
+            if (!FAKE_ENCODER.empty()) {
+              auto frames{ffe::cannedBitstream(FAKE_ENCODER, finalWidth, finalHeight, 30, syntheticSource,
+                                               ffe::FakeEncoder::bitrateKbps(finalWidth, finalHeight), ffe::FakeEncoder::MAX_FRAME_SIZE)};
+              if (frames.empty()) {
+                std::cerr << "[frame-feed-evaluator]: Failed to prepare canned " << FAKE_ENCODER << " frames of at most "
+                          << ffe::FakeEncoder::MAX_FRAME_SIZE << " bytes for the fake encoder." << std::endl;
+                return retCode;
+              }
+              std::clog << "[frame-feed-evaluator]: Fake encoder replies with " << frames.size() << " canned " << FAKE_ENCODER << " frames." << std::endl;
+              fakeEncoder.reset(new ffe::FakeEncoder{NAME, static_cast<uint16_t>(std::stoi(commandlineArguments["cid"])), FAKE_ENCODER, finalWidth, finalHeight, std::move(frames)});
+            }
 
             // Once the shared memory is created, wait for the first frame to replay
             // so that any downstream processes can attach to it.
@@ -194,229 +792,347 @@ int32_t main(int32_t argc, char **argv) {
             }
           }
 
-          // Exclusive access to shared memory.
-          sharedMemoryFori420->lock();
+          ffe::FrameBufferHandle sourceI420Frame{finalI420Pool->acquire()};
+          ffe::FrameBufferHandle resultingI420Frame{finalI420Pool->acquire()};
+
+          // Transform the original image into the cropped i420 frame before
+          // taking the lock; PNG scanlines are converted while streaming,
+          // straight into the cache if enabled.
+          const ffe::FrameBuffer *sourceFrame{sourceI420Frame.get()};
           {
-            // First, transform original image into tempory buffer.
-            libyuv::ABGRToI420(reinterpret_cast<uint8_t*>(rawABGRFromPNG.data()), width * 4 /* 4*WIDTH for ABGR*/,
-                               reinterpret_cast<uint8_t*>(tempImageBuffer.data()), width,
-                               reinterpret_cast<uint8_t*>(tempImageBuffer.data()+(width * height)), width/2,
-                               reinterpret_cast<uint8_t*>(tempImageBuffer.data()+(width * height + ((width * height) >> 2))), width/2,
-                               width, height);
-
-            // Next, crop input image to desired dimensions.
-            libyuv::ConvertToI420(reinterpret_cast<uint8_t*>(tempImageBuffer.data()), width * height * 3/2 /* 3/2*width for I420*/,
-                                  reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalWidth,
-                                  reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight)), finalWidth/2,
-                                  reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2))), finalWidth/2,
-                                  CROP_X, CROP_Y,
-                                  width, height,
-                                  finalWidth, finalHeight,
-                                  static_cast<libyuv::RotationMode>(0), FOURCC('I', '4', '2', '0'));
-
-            // When we need to show the image, transform from i420 back to ARGB.
-            if (VERBOSE) {
-              libyuv::I420ToARGB(reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalWidth,
+            ffe::TraceScope traceScope{traceRecorder.get(), "convert", entryCounter};
+            const ffe::PerfSample perfBegin{ffe::perfBegin(perfCounters.get())};
+            if (!SYNTHETIC.empty()) {
+              ffe::FrameBufferHandle tempImageBuffer{sourceI420Pool->acquire()};
+              syntheticSource.render(entryCounter - 1, *tempImageBuffer);
+              libyuv::I420Copy(tempImageBuffer->y() + CROP_Y * tempImageBuffer->strides[0] + CROP_X, tempImageBuffer->strides[0],
+                               tempImageBuffer->u() + (CROP_Y/2) * tempImageBuffer->strides[1] + CROP_X/2, tempImageBuffer->strides[1],
+                               tempImageBuffer->v() + (CROP_Y/2) * tempImageBuffer->strides[2] + CROP_X/2, tempImageBuffer->strides[2],
+                               sourceI420Frame->y(), sourceI420Frame->strides[0],
+                               sourceI420Frame->u(), sourceI420Frame->strides[1],
+                               sourceI420Frame->v(), sourceI420Frame->strides[2],
+                               finalWidth, finalHeight);
+            }
+            else if (nullptr != cachedFrame) {
+              sourceFrame = cachedFrame;
+              // Frames mapped from disk are kept in memory for the next runs.
+              ffe::FrameBuffer *target{(mappedFromDisk && frameCache) ? frameCache->insert(ffe::FrameCache::key(filename, CROP_X, CROP_Y), width, height) : nullptr};
+              if (nullptr != target) {
+                libyuv::I420Copy(cachedFrame->y(), cachedFrame->strides[0],
+                                 cachedFrame->u(), cachedFrame->strides[1],
+                                 cachedFrame->v(), cachedFrame->strides[2],
+                                 target->y(), target->strides[0],
+                                 target->u(), target->strides[1],
+                                 target->v(), target->strides[2],
+                                 finalWidth, finalHeight);
+                sourceFrame = target;
+              }
+            }
+            else {
+              const std::string KEY{ffe::FrameCache::key(filename, CROP_X, CROP_Y)};
+              ffe::FrameBuffer *target{frameCache ? frameCache->insert(KEY, width, height) : nullptr};
+              target = (nullptr != target) ? target : sourceI420Frame.get();
+              lodePNGRetVal = pngDecoder.toI420(*target, CROP_X, CROP_Y);
+              if ((0 != lodePNGRetVal) && frameCache) {
+                frameCache->erase(KEY);
+              }
+              if ((0 == lodePNGRetVal) && diskFrameCache) {
+                // The first frame is decoded before the disk cache exists.
+                if (diskKey.empty()) {
+                  diskKey = diskFrameCache->key(filename, png, pngSize, CROP_X, CROP_Y);
+                }
+                diskFrameCache->store(diskKey, *target, width, height);
+              }
+              sourceFrame = target;
+            }
+            ffe::perfEnd(perfCounters.get(), "convert", perfBegin);
+          }
+          if (0 != lodePNGRetVal) {
+            std::cerr << "[frame-feed-evaluator]: Error while decoding '" << filename << "': " << pngDecoder.errorText(lodePNGRetVal) << std::endl;
+          }
+          else {
+            // Exclusive access to shared memory; the frame is staged completely
+            // beforehand so that the lock is only held for copying it.
+            int64_t traceBegin{ffe::traceBegin(traceRecorder.get())};
+            const auto lockRequested{std::chrono::steady_clock::now()};
+            sharedMemoryFori420->lock();
+            const auto lockAcquired{std::chrono::steady_clock::now()};
+            {
+              ffe::TraceScope traceScope{traceRecorder.get(), "copy", entryCounter};
+              if (sourceFrame->packed()) {
+                std::memcpy(sharedMemoryFori420->data(), sourceFrame->y(), finalWidth * finalHeight + 2 * ((finalWidth * finalHeight) >> 2));
+              }
+              else {
+                libyuv::I420Copy(sourceFrame->y(), sourceFrame->strides[0],
+                                 sourceFrame->u(), sourceFrame->strides[1],
+                                 sourceFrame->v(), sourceFrame->strides[2],
+                                 reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalWidth,
                                  reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight)), finalWidth/2,
                                  reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2))), finalWidth/2,
-                                 reinterpret_cast<uint8_t*>(rawARGBFrame.data()), finalWidth * 4,
                                  finalWidth, finalHeight);
+              }
+            }
+            sharedMemoryFori420->unlock();
+            {
+              const auto LOCK_HOLD{std::chrono::steady_clock::now() - lockAcquired};
+              framesPublished++;
+              lockWaitTotal += lockAcquired - lockRequested;
+              lockHoldTotal += LOCK_HOLD;
+              lockHoldMaximum = std::max<std::chrono::nanoseconds>(lockHoldMaximum, LOCK_HOLD);
             }
 
-            // Check whether we need to initialize the sourceFrameWindow for viewing.
-            if ((nullptr == sourceFrameDisplay) && VERBOSE) {
-              sourceFrameDisplay = XOpenDisplay(NULL);
-              sourceFrameVisual = DefaultVisual(sourceFrameDisplay, 0);
-              sourceFrameWindow = XCreateSimpleWindow(sourceFrameDisplay, RootWindow(sourceFrameDisplay, 0), 0, 0, finalWidth, finalHeight, 1, 0, 0);
-              sourceFrameXImage = XCreateImage(sourceFrameDisplay, sourceFrameVisual, 24, ZPixmap, 0, reinterpret_cast<char*>(rawARGBFrame.data()), finalWidth, finalHeight, 32, 0);
-              XMapWindow(sourceFrameDisplay, sourceFrameWindow);
+            // Next, inform any downstream processes of the new frame that is ready.
+            ffe::PerfSample perfBegin{ffe::perfBegin(perfCounters.get())};
+            frameInFlight.store(entryCounter);
+            hasReceivedImageReading.store(false);
+            before = cluon::time::now();
+            if (0 == firstPublished.seconds()) {
+              firstPublished = before;
             }
+            sharedMemoryFori420->setTimeStamp(before);
+            sharedMemoryFori420->notifyAll();
+            ffe::traceEnd(traceRecorder.get(), "publish", entryCounter, traceBegin);
+            ffe::perfEnd(perfCounters.get(), "publish", perfBegin);
 
-            // Show the image.
-            if (VERBOSE) {
-              XPutImage(sourceFrameDisplay, sourceFrameWindow, DefaultGC(sourceFrameDisplay, 0), sourceFrameXImage, 0, 0, 0, 0, finalWidth, finalHeight);
+            // The preview only copies the frame while the encoder is working.
+            if (framePreview) {
+              ffe::TraceScope traceScope{traceRecorder.get(), "display", entryCounter};
+              framePreview->show(ffe::FramePreview::SOURCE, *sourceFrame, entryCounter);
             }
 
-            // Check whether we need to initialize the resultingFrameWindow for viewing.
-            if ((nullptr == resultingFrameDisplay) && VERBOSE) {
-              resultingFrameDisplay = XOpenDisplay(NULL);
-              resultingFrameVisual = DefaultVisual(resultingFrameDisplay, 0);
-              resultingFrameWindow = XCreateSimpleWindow(resultingFrameDisplay, RootWindow(resultingFrameDisplay, 0), 0, 0, finalWidth, finalHeight, 1, 0, 0);
-              resultingFrameXImage = XCreateImage(resultingFrameDisplay, resultingFrameVisual, 24, ZPixmap, 0, reinterpret_cast<char*>(resultingRawARGBFrame.data()), finalWidth, finalHeight, 32, 0);
-              XMapWindow(resultingFrameDisplay, resultingFrameWindow);
+            // Wait for the encoded response.
+            {
+                ffe::TraceScope traceScope{traceRecorder.get(), "encoder", entryCounter};
+                uint32_t timeout{TIMEOUT};
+                using namespace std::literals::chrono_literals;
+                while (!hasReceivedImageReading.load() &&
+                       !cluon::TerminateHandler::instance().isTerminated.load() &&
+                       (0 < timeout)) {
+                  std::this_thread::sleep_for(1ms);
+                  timeout--;
+                }
+                if ((0 == timeout) && !hasReceivedImageReading.load()) {
+                  std::cerr << "[frame-feed-evaluator]: Timed out while waiting for encoded frame." << std::endl;
+                  if (EXIT_ON_TIMEOUT) {
+                    return retCode;
+                  }
+                }
+            }
+            if (VERBOSE) {
+              std::clog << "[frame-feed-evaluator]: Received " << imageReading.fourcc() << " of size " << imageReading.data().size() << std::endl;
             }
-          }
-          sharedMemoryFori420->unlock();
 
-          // Next, inform any downstream processes of the new frame that is ready.
-          hasReceivedImageReading.store(false);
-          before = cluon::time::now();
-          sharedMemoryFori420->setTimeStamp(before);
-          sharedMemoryFori420->notifyAll();
+            traceBegin = ffe::traceBegin(traceRecorder.get());
+            perfBegin = ffe::perfBegin(perfCounters.get());
+            bool frameDecodedSuccessfully{false};
+            std::string compressedFrame{imageReading.data()};
+            const uint32_t LEN{static_cast<uint32_t>(compressedFrame.size())};
 
-          // Wait for the encoded response.
-          {
-              uint32_t timeout{TIMEOUT};
-              using namespace std::literals::chrono_literals;
-              while (!hasReceivedImageReading.load() &&
-                     !cluon::TerminateHandler::instance().isTerminated.load() &&
-                     (0 < timeout)) {
-                std::this_thread::sleep_for(1ms);
-                timeout--;
-              }
-              if ((0 == timeout) && !hasReceivedImageReading.load()) {
-                std::cerr << "[frame-feed-evaluator]: Timed out while waiting for encoded frame." << std::endl;
-                if (EXIT_ON_TIMEOUT) {
-                  return retCode;
+            if ( ("VP80" == imageReading.fourcc()) || ("VP90" == imageReading.fourcc()) ) {
+              // Unpack VPx frame.
+              if (!vpxCodecInitialized) {
+                if ("VP80" == imageReading.fourcc()) {
+                  if (!vpx_codec_dec_init(&codec, &vpx_codec_vp8_dx_algo, nullptr, 0)) {
+                    std::clog << "[frame-feed-evaluator]: Using " << vpx_codec_iface_name(&vpx_codec_vp8_dx_algo) << std::endl;
+                    vpxCodecInitialized = true;
+                  }
                 }
-              }
-          }
-          if (VERBOSE) {
-            std::clog << "[frame-feed-evaluator]: Received " << imageReading.fourcc() << " of size " << imageReading.data().size() << std::endl;
-          }
-
-          bool frameDecodedSuccessfully{false};
-          std::string compressedFrame{imageReading.data()};
-          const uint32_t LEN{static_cast<uint32_t>(compressedFrame.size())};
-
-          if ( ("VP80" == imageReading.fourcc()) || ("VP90" == imageReading.fourcc()) ) {
-            // Unpack VPx frame.
-            if (!vpxCodecInitialized) {
-              if ("VP80" == imageReading.fourcc()) {
-                if (!vpx_codec_dec_init(&codec, &vpx_codec_vp8_dx_algo, nullptr, 0)) {
-                  std::clog << "[frame-feed-evaluator]: Using " << vpx_codec_iface_name(&vpx_codec_vp8_dx_algo) << std::endl;
-                  vpxCodecInitialized = true;
+                if ("VP90" == imageReading.fourcc()) {
+                  if (!vpx_codec_dec_init(&codec, &vpx_codec_vp9_dx_algo, nullptr, 0)) {
+                    std::clog << "[frame-feed-evaluator]: Using " << vpx_codec_iface_name(&vpx_codec_vp9_dx_algo) << std::endl;
+                    vpxCodecInitialized = true;
+                  }
                 }
               }
-              if ("VP90" == imageReading.fourcc()) {
-                if (!vpx_codec_dec_init(&codec, &vpx_codec_vp9_dx_algo, nullptr, 0)) {
-                  std::clog << "[frame-feed-evaluator]: Using " << vpx_codec_iface_name(&vpx_codec_vp9_dx_algo) << std::endl;
-                  vpxCodecInitialized = true;
+              if (vpxCodecInitialized) {
+                if (0 < LEN) {
+                  if (vpx_codec_decode(&codec, reinterpret_cast<const unsigned char*>(compressedFrame.c_str()), LEN, nullptr, 0)) {
+                    std::cerr << "[frame-feed-evaluator]: Decoding for current frame failed." << std::endl;
+                  }
+                  else {
+                    frameDecodedSuccessfully = true;
+
+                    vpx_codec_iter_t it{nullptr};
+                    vpx_image_t *yuvFrame{nullptr};
+                    while (nullptr != (yuvFrame = vpx_codec_get_frame(&codec, &it))) {
+                      libyuv::I420Copy(yuvFrame->planes[VPX_PLANE_Y], yuvFrame->stride[VPX_PLANE_Y],
+                                       yuvFrame->planes[VPX_PLANE_U], yuvFrame->stride[VPX_PLANE_U],
+                                       yuvFrame->planes[VPX_PLANE_V], yuvFrame->stride[VPX_PLANE_V],
+                                       resultingI420Frame->y(), resultingI420Frame->strides[0],
+                                       resultingI420Frame->u(), resultingI420Frame->strides[1],
+                                       resultingI420Frame->v(), resultingI420Frame->strides[2],
+                                       finalWidth, finalHeight);
+                    }
+                  }
                 }
               }
             }
-            if (vpxCodecInitialized) {
+            else if ("h264" == imageReading.fourcc()) {
+              // Unpack "h264" frame.
               if (0 < LEN) {
-                if (vpx_codec_decode(&codec, reinterpret_cast<const unsigned char*>(compressedFrame.c_str()), LEN, nullptr, 0)) {
-                  std::cerr << "[frame-feed-evaluator]: Decoding for current frame failed." << std::endl;
+                uint8_t* yuvData[3];
+                SBufferInfo bufferInfo;
+                memset(&bufferInfo, 0, sizeof (SBufferInfo));
+                if (0 != openh264Decoder->DecodeFrame2(reinterpret_cast<const unsigned char*>(compressedFrame.c_str()), LEN, yuvData, &bufferInfo)) {
+                  std::cerr << "[frame-feed-evaluator]: h264 decoding for current frame failed." << std::endl;
                 }
                 else {
-                  frameDecodedSuccessfully = true;
-
-                  vpx_codec_iter_t it{nullptr};
-                  vpx_image_t *yuvFrame{nullptr};
-                  while (nullptr != (yuvFrame = vpx_codec_get_frame(&codec, &it))) {
-                    libyuv::I420Copy(yuvFrame->planes[VPX_PLANE_Y], yuvFrame->stride[VPX_PLANE_Y],
-                                     yuvFrame->planes[VPX_PLANE_U], yuvFrame->stride[VPX_PLANE_U],
-                                     yuvFrame->planes[VPX_PLANE_V], yuvFrame->stride[VPX_PLANE_V],
-                                     reinterpret_cast<uint8_t*>(resultingI420Frame.data()), finalWidth,
-                                     reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth * finalHeight)), finalWidth/2,
-                                     reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2))), finalWidth/2,
+                  if (1 == bufferInfo.iBufferStatus) {
+                    libyuv::I420Copy(yuvData[0], bufferInfo.UsrData.sSystemBuffer.iStride[0],
+                                     yuvData[1], bufferInfo.UsrData.sSystemBuffer.iStride[1],
+                                     yuvData[2], bufferInfo.UsrData.sSystemBuffer.iStride[1],
+                                     resultingI420Frame->y(), resultingI420Frame->strides[0],
+                                     resultingI420Frame->u(), resultingI420Frame->strides[1],
+                                     resultingI420Frame->v(), resultingI420Frame->strides[2],
                                      finalWidth, finalHeight);
-
-                    if (VERBOSE) {
-                      libyuv::I420ToARGB(yuvFrame->planes[VPX_PLANE_Y], yuvFrame->stride[VPX_PLANE_Y],
-                                         yuvFrame->planes[VPX_PLANE_U], yuvFrame->stride[VPX_PLANE_U],
-                                         yuvFrame->planes[VPX_PLANE_V], yuvFrame->stride[VPX_PLANE_V],
-                                         reinterpret_cast<uint8_t*>(resultingRawARGBFrame.data()), finalWidth * 4,
-                                         finalWidth, finalHeight);
-                      XPutImage(resultingFrameDisplay, resultingFrameWindow, DefaultGC(resultingFrameDisplay, 0), resultingFrameXImage, 0, 0, 0, 0, finalWidth, finalHeight);
-                    }
-
+                    frameDecodedSuccessfully = true;
                   }
                 }
               }
             }
-          }
-          else if ("h264" == imageReading.fourcc()) {
-            // Unpack "h264" frame.
-            if (0 < LEN) {
-              uint8_t* yuvData[3];
-              SBufferInfo bufferInfo;
-              memset(&bufferInfo, 0, sizeof (SBufferInfo));
-              if (0 != openh264Decoder->DecodeFrame2(reinterpret_cast<const unsigned char*>(compressedFrame.c_str()), LEN, yuvData, &bufferInfo)) {
-                std::cerr << "[frame-feed-evaluator]: h264 decoding for current frame failed." << std::endl;
-              }
-              else {
-                if (1 == bufferInfo.iBufferStatus) {
-                  libyuv::I420Copy(yuvData[0], bufferInfo.UsrData.sSystemBuffer.iStride[0],
-                                   yuvData[1], bufferInfo.UsrData.sSystemBuffer.iStride[1],
-                                   yuvData[2], bufferInfo.UsrData.sSystemBuffer.iStride[1],
-                                   reinterpret_cast<uint8_t*>(resultingI420Frame.data()), finalWidth,
-                                   reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth * finalHeight)), finalWidth/2,
-                                   reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2))), finalWidth/2,
-                                   finalWidth, finalHeight);
-
-                  if (VERBOSE) {
-                    libyuv::I420ToARGB(yuvData[0], bufferInfo.UsrData.sSystemBuffer.iStride[0],
-                                       yuvData[1], bufferInfo.UsrData.sSystemBuffer.iStride[1],
-                                       yuvData[2], bufferInfo.UsrData.sSystemBuffer.iStride[1],
-                                       reinterpret_cast<uint8_t*>(resultingRawARGBFrame.data()), finalWidth * 4,
-                                       finalWidth, finalHeight);
-                    XPutImage(resultingFrameDisplay, resultingFrameWindow, DefaultGC(resultingFrameDisplay, 0), resultingFrameXImage, 0, 0, 0, 0, finalWidth, finalHeight);
-                  }
-                  frameDecodedSuccessfully = true;
-                }
-              }
+
+            ffe::traceEnd(traceRecorder.get(), "decode", entryCounter, traceBegin);
+            ffe::perfEnd(perfCounters.get(), "decode", perfBegin);
+
+            if (framePreview && frameDecodedSuccessfully) {
+              ffe::TraceScope traceScope{traceRecorder.get(), "display", entryCounter};
+              framePreview->show(ffe::FramePreview::RESULT, *resultingI420Frame, entryCounter);
             }
-          }
 
-          // Compute PSNR/SSIM.
-          if (frameDecodedSuccessfully) {
-            // Show the results.
-            double PSNR =
-libyuv::I420Psnr(reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalWidth,
-             reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight)), finalWidth/2,
-             reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2))), finalWidth/2,
-             reinterpret_cast<uint8_t*>(resultingI420Frame.data()), finalWidth,
-             reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth*finalHeight)), finalWidth/2,
-             reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth*finalHeight)+(finalWidth*finalHeight)/4), finalWidth/2,
-             finalWidth, finalHeight);
-
-            double SSIM =
-libyuv::I420Ssim(reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalWidth,
-             reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight)), finalWidth/2,
-             reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2))), finalWidth/2,
-             reinterpret_cast<uint8_t*>(resultingI420Frame.data()), finalWidth,
-             reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth*finalHeight)), finalWidth/2,
-             reinterpret_cast<uint8_t*>(resultingI420Frame.data()+(finalWidth*finalHeight)+(finalWidth*finalHeight)/4), finalWidth/2,
-             finalWidth, finalHeight);
+            // Compute the selected metrics.
+            if (frameDecodedSuccessfully) {
+              traceBegin = ffe::traceBegin(traceRecorder.get());
+              perfBegin = ffe::perfBegin(perfCounters.get());
+              // The staged frame is compared as the encoder may already work on
+              // the shared memory; all metrics per plane in one pass, PSNR and
+              // SSIM combined as by libyuv::I420Psnr and libyuv::I420Ssim.
+              if (METRIC_TEMPORAL && (sourceFrame != sourceI420Frame.get())) {
+                // Frames of the caches may be gone by the next frame.
+                libyuv::I420Copy(sourceFrame->y(), sourceFrame->strides[0],
+                                 sourceFrame->u(), sourceFrame->strides[1],
+                                 sourceFrame->v(), sourceFrame->strides[2],
+                                 sourceI420Frame->y(), sourceI420Frame->strides[0],
+                                 sourceI420Frame->u(), sourceI420Frame->strides[1],
+                                 sourceI420Frame->v(), sourceI420Frame->strides[2],
+                                 finalWidth, finalHeight);
+                sourceFrame = sourceI420Frame.get();
+              }
+              frameMetrics.compute(*sourceFrame, *resultingI420Frame, finalWidth, finalHeight, previousSourceFrame.get(), previousResultFrame.get());
+              double PSNR{frameMetrics.psnr()};
+              double SSIM{frameMetrics.ssim()};
+              roiMetrics.compute(*sourceFrame, *resultingI420Frame, frameMetrics.shortcut());
+
+              ffe::traceEnd(traceRecorder.get(), "metrics", entryCounter, traceBegin);
+              ffe::perfEnd(perfCounters.get(), "metrics", perfBegin);
 
-            if (SAVE_PNG) {
-              std::vector<unsigned char> image;
-              image.resize(finalWidth * finalHeight * 4);
+              if (SAVE_PNG) {
+                ffe::TraceScope traceScope{traceRecorder.get(), "save", entryCounter};
+                perfBegin = ffe::perfBegin(perfCounters.get());
+                ffe::FrameBufferHandle image{finalABGRPool->acquire()};
+
+                if (-1 == libyuv::I420ToABGR(resultingI420Frame->y(), resultingI420Frame->strides[0],
+                                             resultingI420Frame->u(), resultingI420Frame->strides[1],
+                                             resultingI420Frame->v(), resultingI420Frame->strides[2],
+                                             image->data(), image->stride(),
+                                             finalWidth, finalHeight) ) {
+                    std::cerr << "[frame-feed-evaluator]: Error transforming color space." << std::endl;
+                }
+                else {
+                    std::stringstream tmp;
+                    tmp << "lossy_" << std::setw(10) << std::setfill('0') << entryCounter << std::setfill(' ') << ".png";
+                    const std::string str = tmp.str();
+                    auto r = lodepng::encode(str, image->data(), finalWidth, finalHeight);
+                    if (r) {
+                        std::cerr << "[frame-feed-evaluator]: lodePNG error " << r << ": "<< lodepng_error_text(r) << std::endl;
+                    }
+                }
+                ffe::perfEnd(perfCounters.get(), "save", perfBegin);
+              }
 
-              if (-1 == libyuv::I420ToABGR(resultingI420Frame.data(), finalWidth,
-                                           resultingI420Frame.data()+(finalWidth * finalHeight), finalWidth/2,
-                                           resultingI420Frame.data()+(finalWidth * finalHeight + ((finalWidth * finalHeight) >> 2)), finalWidth/2,
-                                           image.data(), finalWidth * 4,
-                                           finalWidth, finalHeight) ) {
-                  std::cerr << "[frame-feed-evaluator]: Error transforming color space." << std::endl;
+              framesEvaluated++;
+              minimumLatency = std::min(minimumLatency, cluon::time::deltaInMicroseconds(after, before));
+              if (METRIC_PSNR) {
+                psnrStatistics.add(PSNR);
               }
-              else {
-                  std::stringstream tmp;
-                  tmp << "lossy_" << std::setw(10) << std::setfill('0') << entryCounter << std::setfill(' ') << ".png";
-                  const std::string str = tmp.str();
-                  auto r = lodepng::encode(str.c_str(), image, finalWidth, finalHeight);
-                  if (r) {
-                      std::cerr << "[frame-feed-evaluator]: lodePNG error " << r << ": "<< lodepng_error_text(r) << std::endl;
-                  }
+              if (METRIC_SSIM) {
+                ssimStatistics.add(SSIM);
+              }
+              if (METRIC_MSSSIM) {
+                msssimStatistics.add(frameMetrics.msssim());
+              }
+              if (METRIC_TEMPORAL && frameMetrics.hasTemporal()) {
+                temporalPsnrStatistics.add(frameMetrics.temporalPsnr());
+                flickerStatistics.add(frameMetrics.flicker());
+                framesFrozen += frameMetrics.frozen() ? 1 : 0;
+                framesDuplicated += frameMetrics.duplicated() ? 1 : 0;
+              }
+              framesIdentical += (ffe::FrameMetrics::Shortcut::IDENTICAL == frameMetrics.shortcut()) ? 1 : 0;
+              framesRepeated += (ffe::FrameMetrics::Shortcut::REPEATED == frameMetrics.shortcut()) ? 1 : 0;
+              if (0 < roiMetrics.size()) {
+                roiPsnrStatistics.add(roiMetrics.psnr());
+                roiSsimStatistics.add(roiMetrics.ssim());
+              }
+              sizeStatistics.add(static_cast<double>(LEN));
+              durationStatistics.add(static_cast<double>(cluon::time::deltaInMicroseconds(after, before)));
+              bytesEvaluated += LEN;
+              for (uint32_t i{0}; i < 3; i++) {
+                sseEvaluated[i] += frameMetrics[i].sse;
+                samplesEvaluated[i] += frameMetrics[i].samples;
               }
-            }
 
-            std::stringstream sstr;
-            sstr << "[frame-feed-evaluator]: " << filename << ";" << CROP_X << ";" << CROP_Y << ";" << finalWidth << ";" << finalHeight << ";size[bytes];" << LEN << ";" << "PSNR;" << PSNR << ";SSIM;" << SSIM << ";duration[microseconds];" << cluon::time::deltaInMicroseconds(after, before);
-            const std::string str = sstr.str();
-            if (VERBOSE) {
-              std::clog << str << std::endl;
-            }
-            if (reportFile && reportFile->good()) {
-              *reportFile << str << std::endl;
+              reportRow.clear();
+              reportRow.add(filename).add(int64_t{CROP_X}).add(int64_t{CROP_Y}).add(int64_t{finalWidth}).add(int64_t{finalHeight})
+                       .add(int64_t{LEN});
+              if (METRIC_PSNR) {
+                reportRow.add(PSNR);
+              }
+              if (METRIC_SSIM) {
+                reportRow.add(SSIM);
+              }
+              reportRow.add(cluon::time::deltaInMicroseconds(after, before));
+              if (METRIC_PSNR) {
+                reportRow.add(frameMetrics.psnr(0)).add(frameMetrics.psnr(1)).add(frameMetrics.psnr(2)).add(frameMetrics.psnrWeighted());
+              }
+              if (METRIC_SSIM) {
+                reportRow.add(frameMetrics.ssim(0)).add(frameMetrics.ssim(1)).add(frameMetrics.ssim(2));
+              }
+              if (METRIC_PSNR) {
+                reportRow.add(frameMetrics.mse(0)).add(frameMetrics.mse(1)).add(frameMetrics.mse(2));
+              }
+              if (METRIC_MSSSIM) {
+                reportRow.add(frameMetrics.msssim());
+              }
+              if (METRIC_TEMPORAL) {
+                // The first frame has no previous one.
+                const double NONE{std::numeric_limits<double>::quiet_NaN()};
+                const bool HAS{frameMetrics.hasTemporal()};
+                reportRow.add(HAS ? frameMetrics.temporalPsnr() : NONE).add(HAS ? frameMetrics.flicker() : NONE)
+                         .add(HAS ? frameMetrics.frozenBlocks() : NONE)
+                         .add(int64_t{frameMetrics.frozen() ? 1 : 0}).add(int64_t{frameMetrics.duplicated() ? 1 : 0});
+              }
+              for (std::size_t i{0}; i < roiMetrics.size(); i++) {
+                const bool EMPTY{roiMetrics.empty(i)};
+                reportRow.add(EMPTY ? std::numeric_limits<double>::quiet_NaN() : roiMetrics[i].psnr())
+                         .add(EMPTY ? std::numeric_limits<double>::quiet_NaN() : roiMetrics[i].ssim());
+              }
+              if (1 < roiMetrics.size()) {
+                reportRow.add(roiMetrics.psnr()).add(roiMetrics.ssim());
+              }
+              if (VERBOSE) {
+                std::clog << ffe::ReportWriter::toText(REPORT_COLUMNS, reportRow) << std::endl;
+              }
+              if (reportWriter) {
+                reportWriter->append(reportRow);
+              }
+              if (METRIC_TEMPORAL) {
+                previousSourceFrame = std::move(sourceI420Frame);
+                previousResultFrame = std::move(resultingI420Frame);
+              }
             }
           }
         }
         else {
-          std::cerr << "[frame-feed-evaluator]: Error while loading '" << filename << "': " << lodepng_error_text(lodePNGRetVal) << std::endl;
+          std::cerr << "[frame-feed-evaluator]: Error while loading '" << filename << "': " << pngDecoder.errorText(lodePNGRetVal) << std::endl;
         }
 
         // Delay playback if desired.
@@ -425,8 +1141,32 @@ libyuv::I420Ssim(reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalW
         }
 
         // End processing if desired.
-        if ( (STOPAFTER > 0) && (entryCounter > STOPAFTER)) {
-          break;
+        if ( (STOPAFTER > 0) && (entryCounter - runStart > STOPAFTER)) {
+          if (!SWEEP) {
+            break;
+          }
+          // Skip the rest of this run, including the reads already in flight.
+          nextEntry = nextRead = entries.size();
+          while (0 < frameReader.pending()) {
+            frameReader.next(png, pngSize);
+          }
+        }
+      }
+
+      // Summarize the throughput of the evaluator.
+      if (0 < framesEvaluated) {
+        reportThroughput();
+        reportSummary();
+      }
+
+      // Summarize the hardware performance counters per stage.
+      if (perfCounters) {
+        for (const auto &line : perfCounters->summary()) {
+          const std::string str{"# frame-feed-evaluator: " + line};
+          std::clog << str << std::endl;
+          if (reportWriter) {
+            reportWriter->text(str);
+          }
         }
       }
     }
@@ -436,12 +1176,6 @@ libyuv::I420Ssim(reinterpret_cast<uint8_t*>(sharedMemoryFori420->data()), finalW
         WelsDestroyDecoder(openh264Decoder);
     }
 
-    if (nullptr != sourceFrameDisplay) {
-      XCloseDisplay(sourceFrameDisplay);
-    }
-    if (nullptr != resultingFrameDisplay) {
-      XCloseDisplay(resultingFrameDisplay);
-    }
     retCode = 0;
   }
   return retCode;
@@ -0,0 +1,878 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_METRICS_HPP
+#define FRAME_METRICS_HPP
+
+#include "content-hash.hpp"
+#include "frame-buffer-pool.hpp"
+#include "worker-pool.hpp"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * FrameMetrics compare a decoded i420 frame with its source per plane: sum
+ * of squared errors (hence MSE and PSNR) and SSIM, and optionally MS-SSIM of
+ * the luma planes. All are computed in one pass over each plane from the
+ * sums of 4x4 cells; each 8x8 SSIM window at a step of 4 pixels combines four
+ * cells. The planes are split into bands of rows that run on a WorkerPool.
+ *
+ * The combined PSNR and SSIM equal those of libyuv::I420Psnr and
+ * libyuv::I420Ssim: PSNR over the squared errors of all samples, capped at
+ * 128 dB, and SSIM weighted 0.8 (Y) to 0.1 (U) to 0.1 (V).
+ *
+ * MS-SSIM follows Wang, Simoncelli, and Bovik (2003) over five scales with
+ * the same 8x8 windows: the pass over one scale also averages 2x2 pixels
+ * into the next one; contrast and structure of the first four scales and the
+ * SSIM of the last one are weighted 0.0448, 0.2856, 0.3001, 0.2363, 0.1333.
+ *
+ * Temporal metrics compare the changes from the previous frames of source and
+ * result over the 4x4 cells of the luma planes: tPSNR of the difference of
+ * the changes and, as flicker index, the mean absolute difference of the
+ * changes of the cell means. Hashes of every four rows detect decoded frames
+ * that repeat the previous one: frozen if the source changed, duplicated if
+ * the source repeated as well.
+ *
+ * With shortcuts, the metrics are not computed for frames equal to their
+ * source (PSNR of 128 dB, SSIM of 1) and are kept for pairs of frames that
+ * repeat the previous pair, told by hashPlane of the result and, if it
+ * repeated, of the source.
+ */
+class FrameMetrics {
+ private:
+  FrameMetrics(const FrameMetrics &) = delete;
+  FrameMetrics(FrameMetrics &&)      = delete;
+  FrameMetrics &operator=(const FrameMetrics &) = delete;
+  FrameMetrics &operator=(FrameMetrics &&) = delete;
+
+  static constexpr uint32_t SCALES{5};
+  static constexpr uint32_t BAND_CELL_ROWS{16};
+  // Parts of a frame hashed in parallel: four of the luma plane, both chroma planes.
+  static constexpr uint32_t HASH_PARTS{6};
+
+ public:
+  static constexpr double MAX_PSNR{128.0};
+
+  // Metrics to compute, combined as bit set.
+  static constexpr uint32_t METRIC_PSNR{1};
+  static constexpr uint32_t METRIC_SSIM{2};
+  static constexpr uint32_t METRIC_MSSSIM{4};
+  static constexpr uint32_t METRIC_TEMPORAL{8};
+
+  /**
+   * @param names Comma-separated names of metrics (psnr, ssim, msssim, temporal).
+   * @param metrics Resulting bit set.
+   * @return true if all names denote known metrics.
+   */
+  static bool parse(const std::string &names, uint32_t &metrics) noexcept {
+    metrics = 0;
+    std::stringstream sstr{names};
+    std::string name;
+    while (std::getline(sstr, name, ',')) {
+      if ("psnr" == name) {
+        metrics |= METRIC_PSNR;
+      } else if ("ssim" == name) {
+        metrics |= METRIC_SSIM;
+      } else if ("msssim" == name) {
+        metrics |= METRIC_MSSSIM;
+      } else if ("temporal" == name) {
+        metrics |= METRIC_TEMPORAL;
+      } else {
+        return false;
+      }
+    }
+    return 0 != metrics;
+  }
+
+  enum class Shortcut : uint8_t {
+    NONE,      // Computed.
+    IDENTICAL, // Result equals source.
+    REPEATED,  // Source and result repeat the previous ones; metrics kept.
+  };
+
+  struct Plane {
+    uint64_t sse{0};     // Sum of squared errors.
+    uint64_t samples{0};
+    double ssim{0.0};
+  };
+
+  /**
+   * Constructor.
+   *
+   * @param metrics Bit set of the metrics to compute.
+   * @param workers Threads to compute them on; nullptr for the calling one.
+   * @param shortcuts Skip identical and repeated frames.
+   */
+  explicit FrameMetrics(uint32_t metrics = METRIC_PSNR | METRIC_SSIM, WorkerPool *workers = nullptr, bool shortcuts = false) noexcept
+    : m_metrics(metrics)
+    , m_workers(workers)
+    , m_shortcuts(shortcuts)
+    , m_bands()
+    , m_scratch()
+    , m_task([this](uint32_t i) { band(m_bands[i], m_scratch[i]); })
+    , m_hashTask([this](uint32_t i) {
+        m_hashParts[i].hash = hashPlane(m_hashParts[i].data, m_hashParts[i].stride, m_hashParts[i].width, m_hashParts[i].height, i);
+      }) {}
+
+  uint32_t metrics() const noexcept {
+    return m_metrics;
+  }
+
+  /**
+   * This method compares two frames.
+   *
+   * @param source Original frame.
+   * @param result Decoded frame.
+   * @param width Width of the frames.
+   * @param height Height of the frames.
+   * @param previousSource Previous original frame for temporal metrics, if any.
+   * @param previousResult Previous decoded frame for temporal metrics, if any.
+   */
+  void compute(const FrameBuffer &source, const FrameBuffer &result, uint32_t width, uint32_t height,
+               const FrameBuffer *previousSource = nullptr, const FrameBuffer *previousResult = nullptr) noexcept {
+    const bool SSIM{0 != (m_metrics & METRIC_SSIM)};
+    const bool MSSSIM{0 != (m_metrics & METRIC_MSSSIM)};
+    const bool TEMPORAL{0 != (m_metrics & METRIC_TEMPORAL)};
+    const bool PREVIOUS{TEMPORAL && (nullptr != previousSource) && (nullptr != previousResult)};
+    const bool CHROMA{0 != (m_metrics & (METRIC_PSNR | METRIC_SSIM))};
+    const uint32_t CHROMA_WIDTH{(width + 1) / 2}, CHROMA_HEIGHT{(height + 1) / 2};
+
+    m_shortcut = m_shortcuts ? shortcut(source, result, width, height) : Shortcut::NONE;
+    if (Shortcut::REPEATED == m_shortcut) {
+      // The changes from the previous frames are zero.
+      m_temporal = Temporal{};
+      if (PREVIOUS) {
+        m_temporal.cells = static_cast<uint64_t>(width / 4) * (height / 4);
+        m_temporal.valid = (height / 4 == m_previousHashes[0].size());
+        m_temporal.duplicated = m_temporal.valid;
+      }
+      return;
+    }
+    if (Shortcut::IDENTICAL == m_shortcut) {
+      if (!TEMPORAL) {
+        identical(width, height);
+        return;
+      }
+      // The changes from the previous frames need the pass over the planes.
+      m_shortcut = Shortcut::NONE;
+    }
+
+    // Scale 0 of MS-SSIM is the luma plane itself.
+    uint32_t scaleWidth[SCALES]{width}, scaleHeight[SCALES]{height};
+    for (uint32_t s{1}; MSSSIM && (s < SCALES); s++) {
+      scaleWidth[s] = scaleWidth[s - 1] / 2;
+      scaleHeight[s] = scaleHeight[s - 1] / 2;
+      m_scales[s][0].resize(static_cast<std::size_t>(scaleWidth[s]) * scaleHeight[s]);
+      m_scales[s][1].resize(m_scales[s][0].size());
+    }
+
+    m_bands.clear();
+    uint32_t first[3]{0, 0, 0};
+    for (uint32_t i{0}; i < (CHROMA ? 3u : 1u); i++) {
+      first[i] = static_cast<uint32_t>(m_bands.size());
+      addBands(source.planes[i], source.strides[i], result.planes[i], result.strides[i],
+               (0 == i) ? width : CHROMA_WIDTH, (0 == i) ? height : CHROMA_HEIGHT,
+               SSIM, (0 == i) && MSSSIM,
+               ((0 == i) && MSSSIM) ? m_scales[1][0].data() : nullptr, ((0 == i) && MSSSIM) ? m_scales[1][1].data() : nullptr);
+    }
+    if (TEMPORAL) {
+      m_hashes[0].resize(height / 4);
+      m_hashes[1].resize(height / 4);
+      for (uint32_t i{0}; i < (CHROMA ? first[1] : static_cast<uint32_t>(m_bands.size())); i++) {
+        m_bands[i].hashA = m_hashes[0].data();
+        m_bands[i].hashB = m_hashes[1].data();
+        if (PREVIOUS) {
+          m_bands[i].previousA = previousSource->y();
+          m_bands[i].previousStrideA = previousSource->strides[0];
+          m_bands[i].previousB = previousResult->y();
+          m_bands[i].previousStrideB = previousResult->strides[0];
+        }
+      }
+    }
+    run();
+
+    for (uint32_t i{0}; i < 3; i++) {
+      m_planes[i] = Plane{};
+    }
+    for (uint32_t i{0}; i < (CHROMA ? 3u : 1u); i++) {
+      const uint32_t LAST{((i < 2) && CHROMA) ? first[i + 1] : static_cast<uint32_t>(m_bands.size())};
+      const Sums SUMS{sum(first[i], LAST)};
+      m_planes[i].sse = SUMS.sse;
+      m_planes[i].samples = static_cast<uint64_t>((0 == i) ? width : CHROMA_WIDTH) * ((0 == i) ? height : CHROMA_HEIGHT);
+      m_planes[i].ssim = SUMS.ssim;
+      if (0 == i) {
+        m_contrastStructure[0] = SUMS.cs;
+      }
+    }
+
+    m_temporal = Temporal{};
+    if (PREVIOUS) {
+      for (uint32_t i{0}; i < (CHROMA ? first[1] : static_cast<uint32_t>(m_bands.size())); i++) {
+        m_temporal.sse += m_bands[i].temporalSse;
+        m_temporal.dc += m_bands[i].temporalDc;
+      }
+      m_temporal.cells = static_cast<uint64_t>(width / 4) * (height / 4);
+      m_temporal.valid = (m_hashes[0].size() == m_previousHashes[0].size());
+      uint32_t repeated{0}, frozen{0};
+      bool sourceRepeated{true};
+      for (std::size_t i{0}; m_temporal.valid && (i < m_hashes[0].size()); i++) {
+        const bool SOURCE_REPEATED{m_hashes[0][i] == m_previousHashes[0][i]};
+        const bool RESULT_REPEATED{m_hashes[1][i] == m_previousHashes[1][i]};
+        sourceRepeated &= SOURCE_REPEATED;
+        repeated += RESULT_REPEATED ? 1 : 0;
+        frozen += (RESULT_REPEATED && !SOURCE_REPEATED) ? 1 : 0;
+      }
+      const bool RESULT_REPEATED{repeated == m_hashes[1].size()};
+      m_temporal.frozenBlocks = m_hashes[1].empty() ? 0.0 : static_cast<double>(frozen) / static_cast<double>(m_hashes[1].size());
+      m_temporal.frozen = m_temporal.valid && RESULT_REPEATED && !sourceRepeated;
+      m_temporal.duplicated = m_temporal.valid && RESULT_REPEATED && sourceRepeated;
+    }
+    if (TEMPORAL) {
+      std::swap(m_hashes[0], m_previousHashes[0]);
+      std::swap(m_hashes[1], m_previousHashes[1]);
+    }
+
+    m_msssim = 0.0;
+    if (MSSSIM) {
+      constexpr double WEIGHTS[SCALES]{0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+      m_msssim = std::pow(std::max(0.0, m_contrastStructure[0]), WEIGHTS[0]);
+      for (uint32_t s{1}; s < SCALES; s++) {
+        const bool LAST{SCALES - 1 == s};
+        m_bands.clear();
+        addBands(m_scales[s][0].data(), static_cast<int32_t>(scaleWidth[s]), m_scales[s][1].data(), static_cast<int32_t>(scaleWidth[s]),
+                 scaleWidth[s], scaleHeight[s], false, true,
+                 LAST ? nullptr : m_scales[s + 1][0].data(), LAST ? nullptr : m_scales[s + 1][1].data());
+        run();
+        const Sums SUMS{sum(0, static_cast<uint32_t>(m_bands.size()))};
+        m_contrastStructure[s] = SUMS.cs;
+        m_msssim *= std::pow(std::max(0.0, LAST ? SUMS.ssim : SUMS.cs), WEIGHTS[s]);
+      }
+    }
+  }
+
+  /**
+   * This method sets the metrics of frames equal to their source.
+   *
+   * @param width Width of the frames.
+   * @param height Height of the frames.
+   */
+  void identical(uint32_t width, uint32_t height) noexcept {
+    const uint64_t CHROMA{static_cast<uint64_t>((width + 1) / 2) * ((height + 1) / 2)};
+    m_planes[0] = Plane{0, static_cast<uint64_t>(width) * height, 1.0};
+    m_planes[1] = m_planes[2] = Plane{0, CHROMA, 1.0};
+    for (uint32_t s{0}; s < SCALES; s++) {
+      m_contrastStructure[s] = 1.0;
+    }
+    m_msssim = (0 != (m_metrics & METRIC_MSSSIM)) ? 1.0 : 0.0;
+    m_temporal = Temporal{};
+  }
+
+  /**
+   * @return How the last frames were handled.
+   */
+  Shortcut shortcut() const noexcept {
+    return m_shortcut;
+  }
+
+  /**
+   * @return PSNR in dB of the given squared errors, capped at MAX_PSNR.
+   */
+  static double psnr(uint64_t sse, uint64_t samples) noexcept {
+    if ((0 == sse) || (0 == samples)) {
+      return MAX_PSNR;
+    }
+    const double MSE{static_cast<double>(sse) / static_cast<double>(samples)};
+    return std::min(MAX_PSNR, 10.0 * std::log10(255.0 * 255.0 / MSE));
+  }
+
+  const Plane &operator[](std::size_t i) const noexcept {
+    return m_planes[i];
+  }
+
+  double mse(std::size_t i) const noexcept {
+    return (0 < m_planes[i].samples) ? static_cast<double>(m_planes[i].sse) / static_cast<double>(m_planes[i].samples) : 0.0;
+  }
+
+  double psnr(std::size_t i) const noexcept {
+    return psnr(m_planes[i].sse, m_planes[i].samples);
+  }
+
+  double ssim(std::size_t i) const noexcept {
+    return m_planes[i].ssim;
+  }
+
+  /**
+   * @return PSNR over all samples of the frame.
+   */
+  double psnr() const noexcept {
+    return psnr(m_planes[0].sse + m_planes[1].sse + m_planes[2].sse,
+                m_planes[0].samples + m_planes[1].samples + m_planes[2].samples);
+  }
+
+  /**
+   * @return PSNR of the planes weighted 6:1:1 (Y:U:V).
+   */
+  double psnrWeighted() const noexcept {
+    return (6.0 * psnr(0) + psnr(1) + psnr(2)) / 8.0;
+  }
+
+  double ssim() const noexcept {
+    return 0.8 * m_planes[0].ssim + 0.1 * (m_planes[1].ssim + m_planes[2].ssim);
+  }
+
+  /**
+   * @return MS-SSIM of the luma planes.
+   */
+  double msssim() const noexcept {
+    return m_msssim;
+  }
+
+  /**
+   * @return True if the last frames were compared with previous ones.
+   */
+  bool hasTemporal() const noexcept {
+    return m_temporal.valid;
+  }
+
+  /**
+   * @return PSNR of the difference between the changes of source and result
+   *         from their previous frames.
+   */
+  double temporalPsnr() const noexcept {
+    return psnr(m_temporal.sse, m_temporal.cells * 16);
+  }
+
+  /**
+   * @return Mean absolute difference between the changes of the means of
+   *         4x4 cells of source and result, in luma levels.
+   */
+  double flicker() const noexcept {
+    return (0 < m_temporal.cells) ? static_cast<double>(m_temporal.dc) / 16.0 / static_cast<double>(m_temporal.cells) : 0.0;
+  }
+
+  /**
+   * @return Fraction of four-row blocks repeated by the result but not by the source.
+   */
+  double frozenBlocks() const noexcept {
+    return m_temporal.frozenBlocks;
+  }
+
+  /**
+   * @return True if the result repeats the previous one while the source changed.
+   */
+  bool frozen() const noexcept {
+    return m_temporal.frozen;
+  }
+
+  /**
+   * @return True if result and source repeat their previous frames.
+   */
+  bool duplicated() const noexcept {
+    return m_temporal.duplicated;
+  }
+
+ private:
+  struct Cell {
+    uint32_t a{0};
+    uint32_t b{0};
+    uint32_t aa{0};
+    uint32_t bb{0};
+    uint32_t ab{0};
+
+    Cell &operator+=(const Cell &other) noexcept {
+      a += other.a;
+      b += other.b;
+      aa += other.aa;
+      bb += other.bb;
+      ab += other.ab;
+      return *this;
+    }
+  };
+
+  struct TemporalCell {
+    int32_t e{0};
+    uint32_t ee{0};
+  };
+
+  struct Scratch {
+    std::vector<Cell> previous{};
+    std::vector<Cell> current{};
+    std::vector<TemporalCell> temporal{};
+  };
+
+  // Rows of cells of one plane to compare, and their results.
+  struct Band {
+    const uint8_t *a{nullptr};
+    int32_t strideA{0};
+    const uint8_t *b{nullptr};
+    int32_t strideB{0};
+    uint32_t width{0};
+    uint32_t height{0};
+    uint32_t begin{0};
+    uint32_t end{0};
+    bool windows{false};
+    bool msssim{false};      // Contrast and structure of the windows, too.
+    uint8_t *nextA{nullptr}; // Next scale of MS-SSIM, if any.
+    uint8_t *nextB{nullptr};
+    const uint8_t *previousA{nullptr}; // Previous frames for temporal metrics, if any.
+    int32_t previousStrideA{0};
+    const uint8_t *previousB{nullptr};
+    int32_t previousStrideB{0};
+    uint64_t *hashA{nullptr};         // Hashes per row of cells, if any.
+    uint64_t *hashB{nullptr};
+
+    uint64_t sse{0};
+    double ssim{0.0};
+    double cs{0.0};
+    uint64_t count{0};
+    uint64_t temporalSse{0};
+    uint64_t temporalDc{0};
+  };
+
+  struct Temporal {
+    bool valid{false};
+    uint64_t sse{0};
+    uint64_t dc{0};
+    uint64_t cells{0};
+    double frozenBlocks{0.0};
+    bool frozen{false};
+    bool duplicated{false};
+  };
+
+  struct HashPart {
+    const uint8_t *data{nullptr};
+    int32_t stride{0};
+    uint32_t width{0};
+    uint32_t height{0};
+    uint64_t hash{0};
+  };
+
+  struct Sums {
+    uint64_t sse{0};
+    double ssim{1.0};
+    double cs{1.0};
+  };
+
+  void addBands(const uint8_t *a, int32_t strideA, const uint8_t *b, int32_t strideB, uint32_t width, uint32_t height,
+                bool windows, bool msssim, uint8_t *nextA, uint8_t *nextB) noexcept {
+    const uint32_t CELLS_Y{height / 4};
+    uint32_t begin{0};
+    do {
+      Band band;
+      band.a = a;
+      band.strideA = strideA;
+      band.b = b;
+      band.strideB = strideB;
+      band.width = width;
+      band.height = height;
+      band.begin = begin;
+      band.end = std::min(CELLS_Y, begin + BAND_CELL_ROWS);
+      band.windows = windows || msssim;
+      band.msssim = msssim;
+      band.nextA = nextA;
+      band.nextB = nextB;
+      m_bands.push_back(band);
+      begin = band.end;
+    } while (begin < CELLS_Y);
+  }
+
+  Shortcut shortcut(const FrameBuffer &source, const FrameBuffer &result, uint32_t width, uint32_t height) noexcept {
+    const bool SAME_SIZE{(width == m_hashedWidth) && (height == m_hashedHeight)};
+    m_hashedWidth = width;
+    m_hashedHeight = height;
+    // Frames that change cost one hash of the result; the source is hashed
+    // only if the result repeated.
+    const uint64_t RESULT_HASH{hashFrame(result, width, height)};
+    const bool RESULT_REPEATED{SAME_SIZE && m_computed && (RESULT_HASH == m_resultHash)};
+    const bool SOURCE_HASHED{m_sourceHashed};
+    const uint64_t PREVIOUS_SOURCE_HASH{m_sourceHash};
+    m_resultHash = RESULT_HASH;
+    m_sourceHashed = RESULT_REPEATED;
+    if (RESULT_REPEATED) {
+      m_sourceHash = hashFrame(source, width, height);
+      if (SOURCE_HASHED && (m_sourceHash == PREVIOUS_SOURCE_HASH)) {
+        return Shortcut::REPEATED;
+      }
+    }
+    m_computed = true;
+    const uint32_t CHROMA_WIDTH{(width + 1) / 2}, CHROMA_HEIGHT{(height + 1) / 2};
+    for (uint32_t i{0}; i < 3; i++) {
+      const uint32_t W{(0 == i) ? width : CHROMA_WIDTH}, H{(0 == i) ? height : CHROMA_HEIGHT};
+      // Lossy frames differ within the first rows.
+      for (uint32_t y{0}; y < H; y++) {
+        if (0 != std::memcmp(source.planes[i] + static_cast<std::ptrdiff_t>(y) * source.strides[i],
+                             result.planes[i] + static_cast<std::ptrdiff_t>(y) * result.strides[i], W)) {
+          return Shortcut::NONE;
+        }
+      }
+    }
+    return Shortcut::IDENTICAL;
+  }
+
+  uint64_t hashFrame(const FrameBuffer &frame, uint32_t width, uint32_t height) noexcept {
+    const uint32_t CHROMA_WIDTH{(width + 1) / 2}, CHROMA_HEIGHT{(height + 1) / 2};
+    for (uint32_t i{0}; i < 4; i++) {
+      const uint32_t BEGIN{height * i / 4}, END{height * (i + 1) / 4};
+      m_hashParts[i] = HashPart{frame.planes[0] + static_cast<std::ptrdiff_t>(BEGIN) * frame.strides[0], frame.strides[0], width, END - BEGIN, 0};
+    }
+    m_hashParts[4] = HashPart{frame.planes[1], frame.strides[1], CHROMA_WIDTH, CHROMA_HEIGHT, 0};
+    m_hashParts[5] = HashPart{frame.planes[2], frame.strides[2], CHROMA_WIDTH, CHROMA_HEIGHT, 0};
+    if (nullptr != m_workers) {
+      m_workers->parallelFor(HASH_PARTS, m_hashTask);
+    } else {
+      for (uint32_t i{0}; i < HASH_PARTS; i++) {
+        m_hashTask(i);
+      }
+    }
+    uint64_t hashes[HASH_PARTS];
+    for (uint32_t i{0}; i < HASH_PARTS; i++) {
+      hashes[i] = m_hashParts[i].hash;
+    }
+    return hash64(hashes, sizeof(hashes));
+  }
+
+  void run() noexcept {
+    if (m_scratch.size() < m_bands.size()) {
+      m_scratch.resize(m_bands.size());
+    }
+    if (nullptr != m_workers) {
+      m_workers->parallelFor(static_cast<uint32_t>(m_bands.size()), m_task);
+    } else {
+      for (uint32_t i{0}; i < m_bands.size(); i++) {
+        m_task(i);
+      }
+    }
+  }
+
+  // Bands are summed in order so that the results do not depend on threads.
+  Sums sum(uint32_t first, uint32_t last) const noexcept {
+    Sums retVal;
+    double ssimTotal{0.0}, csTotal{0.0};
+    uint64_t count{0};
+    for (uint32_t i{first}; i < last; i++) {
+      retVal.sse += m_bands[i].sse;
+      ssimTotal += m_bands[i].ssim;
+      csTotal += m_bands[i].cs;
+      count += m_bands[i].count;
+    }
+    if (0 < count) {
+      retVal.ssim = ssimTotal / static_cast<double>(count);
+      retVal.cs = csTotal / static_cast<double>(count);
+    }
+    return retVal;
+  }
+
+  static void band(Band &band, Scratch &scratch) noexcept {
+    const uint32_t CELLS_X{band.width / 4}, CELLS_Y{band.height / 4};
+    const uint32_t NEXT_WIDTH{band.width / 2};
+    scratch.previous.resize(CELLS_X);
+    scratch.current.resize(CELLS_X);
+    scratch.temporal.resize(CELLS_X);
+    band.sse = band.count = band.temporalSse = band.temporalDc = 0;
+    band.ssim = band.cs = 0.0;
+    // The windows of the first row of cells need the row above.
+    for (uint32_t cy{(0 < band.begin) ? band.begin - 1 : 0}; cy < band.end; cy++) {
+      const uint8_t *rowA{band.a + static_cast<std::ptrdiff_t>(cy) * 4 * band.strideA};
+      const uint8_t *rowB{band.b + static_cast<std::ptrdiff_t>(cy) * 4 * band.strideB};
+      cells(rowA, band.strideA, rowB, band.strideB, CELLS_X, scratch.current.data());
+      if (cy >= band.begin) {
+        for (uint32_t cx{0}; cx < CELLS_X; cx++) {
+          const Cell &C{scratch.current[cx]};
+          band.sse += static_cast<uint64_t>(C.aa) + C.bb - 2 * static_cast<uint64_t>(C.ab);
+        }
+        // Columns right of the last cell.
+        band.sse += sse(rowA + CELLS_X * 4, band.strideA, rowB + CELLS_X * 4, band.strideB, band.width - CELLS_X * 4, 4);
+        if (nullptr != band.hashA) {
+          band.hashA[cy] = hashRows(rowA, band.strideA, band.width, 4);
+          band.hashB[cy] = hashRows(rowB, band.strideB, band.width, 4);
+        }
+        if (nullptr != band.previousA) {
+          temporalCells(rowA, band.strideA, band.previousA + static_cast<std::ptrdiff_t>(cy) * 4 * band.previousStrideA, band.previousStrideA,
+                        rowB, band.strideB, band.previousB + static_cast<std::ptrdiff_t>(cy) * 4 * band.previousStrideB, band.previousStrideB,
+                        CELLS_X, scratch.temporal.data());
+          for (uint32_t cx{0}; cx < CELLS_X; cx++) {
+            band.temporalSse += scratch.temporal[cx].ee;
+            band.temporalDc += static_cast<uint64_t>(std::abs(scratch.temporal[cx].e));
+          }
+        }
+        if (nullptr != band.nextA) {
+          downsample(rowA, band.strideA, band.nextA + static_cast<std::size_t>(cy) * 2 * NEXT_WIDTH, NEXT_WIDTH, 2);
+          downsample(rowB, band.strideB, band.nextB + static_cast<std::size_t>(cy) * 2 * NEXT_WIDTH, NEXT_WIDTH, 2);
+        }
+
+        // Windows starting at the previous row of cells, i.e., at pixel row
+        // 4 * (cy - 1), as long as libyuv would visit them.
+        const int64_t WINDOW_Y{4 * (static_cast<int64_t>(cy) - 1)};
+        if (band.windows && (0 <= WINDOW_Y) && (WINDOW_Y < static_cast<int64_t>(band.height) - 8)) {
+          for (uint32_t cx{0}; static_cast<int64_t>(cx) * 4 < static_cast<int64_t>(band.width) - 8; cx++) {
+            Cell w{scratch.previous[cx]};
+            w += scratch.previous[cx + 1];
+            w += scratch.current[cx];
+            w += scratch.current[cx + 1];
+            band.ssim += ssim8x8(w);
+            if (band.msssim) {
+              band.cs += contrastStructure8x8(w);
+            }
+            band.count++;
+          }
+        }
+      }
+      std::swap(scratch.previous, scratch.current);
+    }
+    if (band.end == CELLS_Y) {
+      // Rows below the last cell.
+      const uint32_t ROWS{band.height - CELLS_Y * 4};
+      band.sse += sse(band.a + static_cast<std::ptrdiff_t>(CELLS_Y) * 4 * band.strideA, band.strideA,
+                      band.b + static_cast<std::ptrdiff_t>(CELLS_Y) * 4 * band.strideB, band.strideB, band.width, ROWS);
+      if ((nullptr != band.nextA) && (2 <= ROWS)) {
+        downsample(band.a + static_cast<std::ptrdiff_t>(CELLS_Y) * 4 * band.strideA, band.strideA,
+                   band.nextA + static_cast<std::size_t>(CELLS_Y) * 2 * NEXT_WIDTH, NEXT_WIDTH, 1);
+        downsample(band.b + static_cast<std::ptrdiff_t>(CELLS_Y) * 4 * band.strideB, band.strideB,
+                   band.nextB + static_cast<std::size_t>(CELLS_Y) * 2 * NEXT_WIDTH, NEXT_WIDTH, 1);
+      }
+    }
+  }
+
+  // Average of 2x2 pixels, rounded, for the given rows and width of dst.
+  static void downsample(const uint8_t *src, int32_t stride, uint8_t *dst, uint32_t width, uint32_t rows) noexcept {
+    for (uint32_t y{0}; y < rows; y++) {
+      const uint8_t *row0{src + static_cast<std::ptrdiff_t>(2 * y) * stride};
+      const uint8_t *row1{row0 + stride};
+      uint8_t *out{dst + static_cast<std::size_t>(y) * width};
+      uint32_t x{0};
+#if defined(__SSE2__)
+      const __m128i LOW_BYTES{_mm_set1_epi16(0x00ff)};
+      const __m128i TWO{_mm_set1_epi16(2)};
+      for (; x + 16 <= width; x += 16) {
+        __m128i halves[2];
+        for (uint32_t i{0}; i < 2; i++) {
+          const __m128i R0{_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * x + 16 * i))};
+          const __m128i R1{_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * x + 16 * i))};
+          const __m128i SUM0{_mm_add_epi16(_mm_and_si128(R0, LOW_BYTES), _mm_srli_epi16(R0, 8))};
+          const __m128i SUM1{_mm_add_epi16(_mm_and_si128(R1, LOW_BYTES), _mm_srli_epi16(R1, 8))};
+          halves[i] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(SUM0, SUM1), TWO), 2);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(halves[0], halves[1]));
+      }
+#endif
+      for (; x < width; x++) {
+        out[x] = static_cast<uint8_t>((row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2);
+      }
+    }
+  }
+
+  static uint64_t hashRows(const uint8_t *data, int32_t stride, uint32_t width, uint32_t rows) noexcept {
+    uint64_t h{0};
+    for (uint32_t y{0}; y < rows; y++) {
+      h = hash64(data + static_cast<std::ptrdiff_t>(y) * stride, width, h);
+    }
+    return h;
+  }
+
+  // Sums of the difference e = (b - previousB) - (a - previousA) of the
+  // changes of the next four rows per cell of 4x4 pixels, and of its squares.
+  static void temporalCells(const uint8_t *a, int32_t strideA, const uint8_t *pa, int32_t stridePA,
+                            const uint8_t *b, int32_t strideB, const uint8_t *pb, int32_t stridePB,
+                            uint32_t count, TemporalCell *dst) noexcept {
+    uint32_t cx{0};
+#if defined(__SSE2__)
+    const __m128i ZERO{_mm_setzero_si128()};
+    const __m128i ONES{_mm_set1_epi16(1)};
+    for (; cx + 4 <= count; cx += 4) {
+      __m128i e[2]{ZERO, ZERO}, ee[2]{ZERO, ZERO};
+      for (uint32_t r{0}; r < 4; r++) {
+        const __m128i A{_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + r * strideA + cx * 4))};
+        const __m128i PA{_mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + r * stridePA + cx * 4))};
+        const __m128i B{_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + r * strideB + cx * 4))};
+        const __m128i PB{_mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + r * stridePB + cx * 4))};
+        // e = (b + previousA) - (a + previousB) in 16 bits.
+        const __m128i E[2]{
+          _mm_sub_epi16(_mm_add_epi16(_mm_unpacklo_epi8(B, ZERO), _mm_unpacklo_epi8(PA, ZERO)),
+                        _mm_add_epi16(_mm_unpacklo_epi8(A, ZERO), _mm_unpacklo_epi8(PB, ZERO))),
+          _mm_sub_epi16(_mm_add_epi16(_mm_unpackhi_epi8(B, ZERO), _mm_unpackhi_epi8(PA, ZERO)),
+                        _mm_add_epi16(_mm_unpackhi_epi8(A, ZERO), _mm_unpackhi_epi8(PB, ZERO)))};
+        for (uint32_t i{0}; i < 2; i++) {
+          e[i] = _mm_add_epi32(e[i], _mm_madd_epi16(E[i], ONES));
+          ee[i] = _mm_add_epi32(ee[i], _mm_madd_epi16(E[i], E[i]));
+        }
+      }
+      for (uint32_t i{0}; i < 2; i++) {
+        const __m128i LOW[2]{pairSums(e[i]), pairSums(ee[i])};
+        for (uint32_t k{0}; k < 2; k++) {
+          TemporalCell &c{dst[cx + i * 2 + k]};
+          c.e = static_cast<int32_t>(lane(LOW[0], k));
+          c.ee = lane(LOW[1], k);
+        }
+      }
+    }
+#endif
+    for (; cx < count; cx++) {
+      TemporalCell c;
+      for (uint32_t r{0}; r < 4; r++) {
+        for (uint32_t x{cx * 4}; x < cx * 4 + 4; x++) {
+          const int32_t E{(static_cast<int32_t>(b[r * strideB + x]) - pb[r * stridePB + x]) -
+                          (static_cast<int32_t>(a[r * strideA + x]) - pa[r * stridePA + x])};
+          c.e += E;
+          c.ee += static_cast<uint32_t>(E * E);
+        }
+      }
+      dst[cx] = c;
+    }
+  }
+
+  // Sums of the next four rows per cell of 4x4 pixels.
+  static void cells(const uint8_t *a, int32_t strideA, const uint8_t *b, int32_t strideB, uint32_t count, Cell *dst) noexcept {
+    uint32_t cx{0};
+#if defined(__SSE2__)
+    // Four cells per iteration; madd sums adjacent pixels into 32 bits.
+    const __m128i ZERO{_mm_setzero_si128()};
+    const __m128i ONES{_mm_set1_epi16(1)};
+    for (; cx + 4 <= count; cx += 4) {
+      __m128i sumA[2]{ZERO, ZERO}, sumB[2]{ZERO, ZERO}, aa[2]{ZERO, ZERO}, bb[2]{ZERO, ZERO}, ab[2]{ZERO, ZERO};
+      for (uint32_t r{0}; r < 4; r++) {
+        const __m128i A{_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + r * strideA + cx * 4))};
+        const __m128i B{_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + r * strideB + cx * 4))};
+        const __m128i A16[2]{_mm_unpacklo_epi8(A, ZERO), _mm_unpackhi_epi8(A, ZERO)};
+        const __m128i B16[2]{_mm_unpacklo_epi8(B, ZERO), _mm_unpackhi_epi8(B, ZERO)};
+        for (uint32_t i{0}; i < 2; i++) {
+          sumA[i] = _mm_add_epi32(sumA[i], _mm_madd_epi16(A16[i], ONES));
+          sumB[i] = _mm_add_epi32(sumB[i], _mm_madd_epi16(B16[i], ONES));
+          aa[i] = _mm_add_epi32(aa[i], _mm_madd_epi16(A16[i], A16[i]));
+          bb[i] = _mm_add_epi32(bb[i], _mm_madd_epi16(B16[i], B16[i]));
+          ab[i] = _mm_add_epi32(ab[i], _mm_madd_epi16(A16[i], B16[i]));
+        }
+      }
+      for (uint32_t i{0}; i < 2; i++) {
+        const __m128i LOW[5]{pairSums(sumA[i]), pairSums(sumB[i]), pairSums(aa[i]), pairSums(bb[i]), pairSums(ab[i])};
+        for (uint32_t k{0}; k < 2; k++) {
+          Cell &c{dst[cx + i * 2 + k]};
+          c.a = lane(LOW[0], k);
+          c.b = lane(LOW[1], k);
+          c.aa = lane(LOW[2], k);
+          c.bb = lane(LOW[3], k);
+          c.ab = lane(LOW[4], k);
+        }
+      }
+    }
+#endif
+    for (; cx < count; cx++) {
+      Cell c;
+      for (uint32_t r{0}; r < 4; r++) {
+        for (uint32_t x{cx * 4}; x < cx * 4 + 4; x++) {
+          const uint32_t A{a[r * strideA + x]}, B{b[r * strideB + x]};
+          c.a += A;
+          c.b += B;
+          c.aa += A * A;
+          c.bb += B * B;
+          c.ab += A * B;
+        }
+      }
+      dst[cx] = c;
+    }
+  }
+
+#if defined(__SSE2__)
+  // (v0 + v1, v2 + v3) in the lower two lanes.
+  static __m128i pairSums(__m128i v) noexcept {
+    return _mm_add_epi32(_mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 2, 0)), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 1)));
+  }
+
+  static uint32_t lane(__m128i v, uint32_t k) noexcept {
+    return static_cast<uint32_t>(_mm_cvtsi128_si32((0 == k) ? v : _mm_srli_si128(v, 4)));
+  }
+#endif
+
+  static uint64_t sse(const uint8_t *a, int32_t strideA, const uint8_t *b, int32_t strideB, uint32_t width, uint32_t height) noexcept {
+    uint64_t retVal{0};
+    for (uint32_t y{0}; y < height; y++) {
+      for (uint32_t x{0}; x < width; x++) {
+        const int32_t D{static_cast<int32_t>(a[y * strideA + x]) - static_cast<int32_t>(b[y * strideB + x])};
+        retVal += static_cast<uint64_t>(D * D);
+      }
+    }
+    return retVal;
+  }
+
+  // Integer arithmetic as in libyuv's Ssim8x8_C.
+  static double ssim8x8(const Cell &w) noexcept {
+    constexpr int64_t COUNT{64};
+    constexpr int64_t C1{(26634 * COUNT * COUNT) >> 12};  // 64^2 * (0.01 * 255)^2
+    constexpr int64_t C2{(239708 * COUNT * COUNT) >> 12}; // 64^2 * (0.03 * 255)^2
+    const int64_t SUM_A{w.a}, SUM_B{w.b};
+    const int64_t SUM_A_X_SUM_B{SUM_A * SUM_B};
+    const int64_t SSIM_N{(2 * SUM_A_X_SUM_B + C1) * (2 * COUNT * static_cast<int64_t>(w.ab) - 2 * SUM_A_X_SUM_B + C2)};
+    const int64_t SUM_A_SQ{SUM_A * SUM_A}, SUM_B_SQ{SUM_B * SUM_B};
+    const int64_t SSIM_D{(SUM_A_SQ + SUM_B_SQ + C1) *
+                         (COUNT * static_cast<int64_t>(w.aa) - SUM_A_SQ + COUNT * static_cast<int64_t>(w.bb) - SUM_B_SQ + C2)};
+    return static_cast<double>(SSIM_N) / static_cast<double>(SSIM_D);
+  }
+
+  // Contrast and structure terms of SSIM, i.e., without luminance.
+  static double contrastStructure8x8(const Cell &w) noexcept {
+    constexpr int64_t COUNT{64};
+    constexpr int64_t C2{(239708 * COUNT * COUNT) >> 12};
+    const int64_t SUM_A{w.a}, SUM_B{w.b};
+    const int64_t N{2 * COUNT * static_cast<int64_t>(w.ab) - 2 * SUM_A * SUM_B + C2};
+    const int64_t D{COUNT * static_cast<int64_t>(w.aa) - SUM_A * SUM_A + COUNT * static_cast<int64_t>(w.bb) - SUM_B * SUM_B + C2};
+    return static_cast<double>(N) / static_cast<double>(D);
+  }
+
+ private:
+  uint32_t m_metrics{METRIC_PSNR | METRIC_SSIM};
+  WorkerPool *m_workers{nullptr};
+  bool m_shortcuts{false};
+  Shortcut m_shortcut{Shortcut::NONE};
+  Plane m_planes[3]{};
+  double m_contrastStructure[SCALES]{};
+  double m_msssim{0.0};
+  Temporal m_temporal{};
+  // Hashes per row of cells of the luma planes of source and result.
+  std::vector<uint64_t> m_hashes[2]{};
+  std::vector<uint64_t> m_previousHashes[2]{};
+  std::vector<Band> m_bands;
+  std::vector<Scratch> m_scratch;
+  const std::function<void(uint32_t)> m_task;
+  // Hashes of the last frames for the shortcuts.
+  HashPart m_hashParts[HASH_PARTS]{};
+  const std::function<void(uint32_t)> m_hashTask;
+  bool m_computed{false}; // Metrics of previous frames are kept.
+  uint32_t m_hashedWidth{0};
+  uint32_t m_hashedHeight{0};
+  uint64_t m_resultHash{0};
+  uint64_t m_sourceHash{0};
+  bool m_sourceHashed{false};
+  // Scales 1 to 4 of the luma planes of source and result for MS-SSIM.
+  std::vector<uint8_t> m_scales[SCALES][2]{};
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_PREVIEW_HPP
+#define FRAME_PREVIEW_HPP
+
+#include "difference-map.hpp"
+#include "frame-buffer-pool.hpp"
+
+#include <libyuv.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef HAVE_XSHM
+  #include <sys/ipc.h>
+  #include <sys/shm.h>
+  #include <X11/extensions/XShm.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace ffe {
+
+/**
+ * A FramePreview shows the source and the resulting frames in two X11
+ * windows from its own thread. Callers hand over i420 frames, which are only
+ * copied; converting to ARGB and talking to the X server happen on the
+ * preview thread, with MIT-SHM where available. Only the latest frame per
+ * window is shown; frames handed over before the previous one was shown are
+ * dropped so that callers never wait for the X server.
+ *
+ * Optionally, a third window shows a DifferenceMap of a source frame and its
+ * result; it is rendered on the preview thread at a limited rate.
+ */
+class FramePreview {
+ private:
+  FramePreview(const FramePreview &) = delete;
+  FramePreview(FramePreview &&)      = delete;
+  FramePreview &operator=(const FramePreview &) = delete;
+  FramePreview &operator=(FramePreview &&) = delete;
+
+ public:
+  enum View : uint32_t {
+    SOURCE = 0,
+    RESULT = 1,
+    HEATMAP = 2,
+    VIEWS
+  };
+
+ private:
+  struct Slot {
+    FrameBufferHandle frame{nullptr, FrameBufferRecycler{}};
+    uint32_t id{0};
+  };
+
+  // Frames of a view rotate between the caller (back), the hand-over (latest),
+  // and the preview thread (front); the preview thread keeps the source shown
+  // before (previous) to pair it with a late result for the heatmap.
+  struct Slots {
+    Slot back{};
+    Slot latest{};
+    Slot front{};
+    Slot previous{};
+    bool fresh{false};
+  };
+
+  struct Output {
+    Window window{0};
+    XImage *image{nullptr};
+#ifdef HAVE_XSHM
+    XShmSegmentInfo shmInfo{};
+#endif
+    FrameBufferHandle argb{nullptr, FrameBufferRecycler{}};
+  };
+
+ public:
+  /**
+   * Constructor; opens the windows on the default display.
+   *
+   * @param width Width of the frames.
+   * @param height Height of the frames.
+   * @param heatmap Difference map to show in a third window, if any.
+   * @param heatmapFps Maximum rate of the difference map.
+   */
+  FramePreview(uint32_t width, uint32_t height, DifferenceMap::Mode heatmap = DifferenceMap::Mode::OFF, uint32_t heatmapFps = 5) noexcept
+    : m_width(width)
+    , m_height(height)
+    , m_views((DifferenceMap::Mode::OFF == heatmap) ? HEATMAP : VIEWS)
+    , m_heatmapInterval((0 < heatmapFps) ? std::chrono::microseconds(1000 * 1000 / heatmapFps) : std::chrono::microseconds(0))
+    , m_differenceMap(heatmap, width, height)
+    , m_i420Pool(PixelFormat::I420, width, height, 4 * HEATMAP)
+    , m_argbPool(PixelFormat::ARGB, width, height, VIEWS)
+    , m_slots()
+    , m_outputs()
+    , m_mutex()
+    , m_wakeUp()
+    , m_thread() {
+    m_display = XOpenDisplay(nullptr);
+    if ((nullptr == m_display) || !m_i420Pool.valid() || !m_argbPool.valid()) {
+      return;
+    }
+    for (auto &slots : m_slots) {
+      slots.back.frame = m_i420Pool.acquire();
+      slots.latest.frame = m_i420Pool.acquire();
+      slots.front.frame = m_i420Pool.acquire();
+      slots.previous.frame = m_i420Pool.acquire();
+    }
+#ifdef HAVE_XSHM
+    m_usesSharedMemory = (True == XShmQueryExtension(m_display));
+#endif
+    const char *TITLES[VIEWS]{"frame-feed-evaluator: source", "frame-feed-evaluator: result", "frame-feed-evaluator: difference"};
+    Visual *visual{DefaultVisual(m_display, 0)};
+    for (uint32_t view{0}; view < m_views; view++) {
+      Output &output{m_outputs[view]};
+      output.window = XCreateSimpleWindow(m_display, RootWindow(m_display, 0), 0, 0, m_width, m_height, 1, 0, 0);
+      XStoreName(m_display, output.window, TITLES[view]);
+      if (m_usesSharedMemory && !createSharedImage(visual, output)) {
+        // E.g., a remote display; all windows fall back to XPutImage.
+        m_usesSharedMemory = false;
+        for (uint32_t i{0}; i < view; i++) {
+          destroyImage(m_outputs[i]);
+        }
+      }
+      XMapWindow(m_display, output.window);
+    }
+    for (uint32_t view{0}; view < m_views; view++) {
+      Output &output{m_outputs[view]};
+      if (nullptr == output.image) {
+        output.argb = m_argbPool.acquire();
+        output.image = XCreateImage(m_display, visual, 24, ZPixmap, 0, reinterpret_cast<char*>(output.argb->data()),
+                                    m_width, m_height, 32, output.argb->stride());
+      }
+    }
+    XFlush(m_display);
+    m_thread = std::thread(&FramePreview::run, this);
+  }
+
+  ~FramePreview() noexcept {
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      m_running = false;
+    }
+    m_wakeUp.notify_one();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    if (nullptr != m_display) {
+      for (auto &output : m_outputs) {
+        destroyImage(output);
+      }
+      XCloseDisplay(m_display);
+    }
+  }
+
+  bool valid() const noexcept {
+    return m_thread.joinable();
+  }
+
+  bool usesSharedMemory() const noexcept {
+    return m_usesSharedMemory;
+  }
+
+  /**
+   * This method hands over a frame to show; it only copies the frame and
+   * never waits for the preview thread.
+   *
+   * @param view Window to show the frame in (SOURCE or RESULT).
+   * @param i420 Frame of the size of the preview.
+   * @param id Number of the frame; pairs source and result for the heatmap.
+   */
+  void show(View view, const FrameBuffer &i420, uint32_t id) noexcept {
+    if (!valid() || (HEATMAP <= view)) {
+      return;
+    }
+    Slots &slots{m_slots[view]};
+    const FrameBuffer &back{*slots.back.frame};
+    libyuv::I420Copy(i420.y(), i420.strides[0], i420.u(), i420.strides[1], i420.v(), i420.strides[2],
+                     back.y(), back.strides[0], back.u(), back.strides[1], back.v(), back.strides[2],
+                     static_cast<int>(m_width), static_cast<int>(m_height));
+    slots.back.id = id;
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      std::swap(slots.back, slots.latest);
+      if (slots.fresh) {
+        m_dropped++;
+      }
+      slots.fresh = true;
+    }
+    m_wakeUp.notify_one();
+  }
+
+  /**
+   * @return Number of frames shown, excluding heatmaps.
+   */
+  uint64_t shown() const noexcept {
+    return m_shown.load();
+  }
+
+  /**
+   * @return Number of frames replaced by a newer one before they were shown.
+   */
+  uint64_t dropped() const noexcept {
+    return m_dropped.load();
+  }
+
+ private:
+  void run() noexcept {
+    auto lastHeatmap = std::chrono::steady_clock::now() - m_heatmapInterval;
+    while (true) {
+      bool draw[HEATMAP]{};
+      {
+        std::unique_lock<std::mutex> lck(m_mutex);
+        m_wakeUp.wait_for(lck, std::chrono::milliseconds(100), [this]{
+          return !m_running || m_slots[SOURCE].fresh || m_slots[RESULT].fresh;
+        });
+        if (!m_running) {
+          break;
+        }
+        for (uint32_t view{0}; view < HEATMAP; view++) {
+          Slots &slots{m_slots[view]};
+          if (slots.fresh) {
+            std::swap(slots.previous, slots.front);
+            std::swap(slots.latest, slots.front);
+            slots.fresh = false;
+            draw[view] = true;
+          }
+        }
+      }
+      for (uint32_t view{0}; view < HEATMAP; view++) {
+        if (draw[view]) {
+          const FrameBuffer &i420{*m_slots[view].front.frame};
+          Output &output{m_outputs[view]};
+          libyuv::I420ToARGB(i420.y(), i420.strides[0], i420.u(), i420.strides[1], i420.v(), i420.strides[2],
+                             reinterpret_cast<uint8_t*>(output.image->data), output.image->bytes_per_line,
+                             static_cast<int>(m_width), static_cast<int>(m_height));
+          put(output);
+          m_shown++;
+        }
+      }
+      if ((HEATMAP < m_views) && draw[RESULT] && (m_heatmapInterval <= std::chrono::steady_clock::now() - lastHeatmap)) {
+        // The source of the result may have been replaced by the next one already.
+        const Slots &sources{m_slots[SOURCE]};
+        const Slot &result{m_slots[RESULT].front};
+        const Slot *source{(sources.front.id == result.id) ? &sources.front : ((sources.previous.id == result.id) ? &sources.previous : nullptr)};
+        if (nullptr != source) {
+          Output &output{m_outputs[HEATMAP]};
+          m_differenceMap.render(*source->frame, *result.frame, reinterpret_cast<uint8_t*>(output.image->data), output.image->bytes_per_line);
+          put(output);
+          lastHeatmap = std::chrono::steady_clock::now();
+        }
+      }
+      // Waiting for the X server here keeps the images from being
+      // overwritten while it still reads them; events are discarded.
+      XSync(m_display, True);
+    }
+  }
+
+  void put(Output &output) noexcept {
+#ifdef HAVE_XSHM
+    if (m_usesSharedMemory) {
+      XShmPutImage(m_display, output.window, DefaultGC(m_display, 0), output.image, 0, 0, 0, 0, m_width, m_height, False);
+      return;
+    }
+#endif
+    XPutImage(m_display, output.window, DefaultGC(m_display, 0), output.image, 0, 0, 0, 0, m_width, m_height);
+  }
+
+#ifdef HAVE_XSHM
+  static int onAttachError(Display *, XErrorEvent *) noexcept {
+    attachFailed() = true;
+    return 0;
+  }
+
+  static bool &attachFailed() noexcept {
+    static bool failed{false};
+    return failed;
+  }
+
+  bool createSharedImage(Visual *visual, Output &output) noexcept {
+    output.image = XShmCreateImage(m_display, visual, 24, ZPixmap, nullptr, &output.shmInfo, m_width, m_height);
+    if (nullptr == output.image) {
+      return false;
+    }
+    output.shmInfo.shmid = ::shmget(IPC_PRIVATE, static_cast<std::size_t>(output.image->bytes_per_line) * output.image->height, IPC_CREAT | 0600);
+    if (0 > output.shmInfo.shmid) {
+      XDestroyImage(output.image);
+      output.image = nullptr;
+      return false;
+    }
+    output.shmInfo.shmaddr = output.image->data = static_cast<char*>(::shmat(output.shmInfo.shmid, nullptr, 0));
+    output.shmInfo.readOnly = False;
+
+    // The X server reports failures to attach asynchronously.
+    attachFailed() = false;
+    auto previousHandler = XSetErrorHandler(&FramePreview::onAttachError);
+    const bool ATTACHED{(reinterpret_cast<char*>(-1) != output.shmInfo.shmaddr) && (True == XShmAttach(m_display, &output.shmInfo))};
+    XSync(m_display, False);
+    XSetErrorHandler(previousHandler);
+    // The segment is released once both sides detached.
+    ::shmctl(output.shmInfo.shmid, IPC_RMID, nullptr);
+    if (!ATTACHED || attachFailed()) {
+      if (reinterpret_cast<char*>(-1) != output.shmInfo.shmaddr) {
+        ::shmdt(output.shmInfo.shmaddr);
+      }
+      output.shmInfo.shmaddr = nullptr;
+      output.image->data = nullptr;
+      XDestroyImage(output.image);
+      output.image = nullptr;
+      return false;
+    }
+    return true;
+  }
+#else
+  bool createSharedImage(Visual *, Output &) noexcept {
+    return false;
+  }
+#endif
+
+  void destroyImage(Output &output) noexcept {
+    if (nullptr == output.image) {
+      return;
+    }
+#ifdef HAVE_XSHM
+    if (nullptr != output.shmInfo.shmaddr) {
+      XShmDetach(m_display, &output.shmInfo);
+      XSync(m_display, False);
+      ::shmdt(output.shmInfo.shmaddr);
+      output.shmInfo.shmaddr = nullptr;
+    }
+#endif
+    // The pixels belong to the shared memory or the pool.
+    output.image->data = nullptr;
+    XDestroyImage(output.image);
+    output.image = nullptr;
+    output.argb.reset();
+  }
+
+ private:
+  uint32_t m_width{0};
+  uint32_t m_height{0};
+  uint32_t m_views{HEATMAP};
+  std::chrono::microseconds m_heatmapInterval;
+  DifferenceMap m_differenceMap;
+  FrameBufferPool m_i420Pool;
+  FrameBufferPool m_argbPool;
+  Slots m_slots[HEATMAP];
+  Output m_outputs[VIEWS];
+  Display *m_display{nullptr};
+  bool m_usesSharedMemory{false};
+  std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  bool m_running{true};
+  std::atomic<uint64_t> m_shown{0};
+  std::atomic<uint64_t> m_dropped{0};
+  std::thread m_thread;
+};
+
+} // namespace ffe
+
+#endif
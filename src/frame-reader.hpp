@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_READER_HPP
+#define FRAME_READER_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A FrameReader reads the files of upcoming frames ahead of time into pooled
+ * buffers. With io_uring, the reads of up to depth files are in flight at
+ * once so that fast storage is kept busy while the main thread decodes; reads
+ * are queued as files are submitted and passed to the kernel together when
+ * the next file is requested. The files are handed out in the order they
+ * were submitted. Without io_uring
+ * (not built in, or not permitted at runtime), each file is read with pread
+ * when it is handed out; so are files whose reads could not be submitted,
+ * and all files once waiting for the ring failed.
+ */
+class FrameReader {
+ private:
+  FrameReader(const FrameReader &) = delete;
+  FrameReader(FrameReader &&)      = delete;
+  FrameReader &operator=(const FrameReader &) = delete;
+  FrameReader &operator=(FrameReader &&) = delete;
+
+  // Granularity of buffers and read lengths; suits O_DIRECT on common devices.
+  static constexpr std::size_t READ_ALIGNMENT{4096};
+
+  struct Slot {
+    std::string filename{};
+    int fd{-1};
+    uint8_t *buffer{nullptr};
+    std::size_t capacity{0};
+    std::size_t size{0};
+    std::size_t done{0};
+    int error{0};
+    bool complete{false};
+    bool direct{false}; // Opened with O_DIRECT.
+    bool inFlight{false}; // The kernel owns the buffer.
+    struct iovec iov{};
+  };
+
+ public:
+  /**
+   * Constructor.
+   *
+   * @param depth Number of files to read ahead.
+   * @param useIoUring Use io_uring if available; pread otherwise.
+   * @param direct Bypass the page cache with O_DIRECT where supported.
+   */
+  FrameReader(uint32_t depth, bool useIoUring, bool direct) noexcept
+    : m_slots((0 < depth ? depth : 1) + 1)
+    , m_direct(direct) {
+#ifdef HAVE_IO_URING
+    if (useIoUring) {
+      setupRing();
+    }
+#else
+    (void)useIoUring;
+#endif
+  }
+
+  ~FrameReader() noexcept {
+#ifdef HAVE_IO_URING
+    // The kernel may still write into buffers of reads in flight.
+    if (0 <= m_ringFd) {
+      flush();
+    }
+    while (0 < m_inFlight) {
+      if (!reap(true)) {
+        abandonRing();
+      }
+    }
+    closeRing();
+#endif
+    for (auto &slot : m_slots) {
+      if (0 <= slot.fd) {
+        ::close(slot.fd);
+      }
+      if (nullptr != slot.buffer) {
+        ::munmap(slot.buffer, slot.capacity);
+      }
+    }
+  }
+
+  /**
+   * @return Name of the backend in use (io_uring, pread).
+   */
+  const char *backend() const noexcept {
+#ifdef HAVE_IO_URING
+    if (0 <= m_ringFd) {
+      return "io_uring";
+    }
+#endif
+    return "pread";
+  }
+
+  /**
+   * @return Number of files submitted but not handed out yet.
+   */
+  std::size_t pending() const noexcept {
+    return m_count - (m_holding ? 1 : 0);
+  }
+
+  /**
+   * @return Name of the file handed out next; only valid if pending() > 0.
+   */
+  const std::string &front() const noexcept {
+    return m_slots[(m_head + (m_holding ? 1 : 0)) % m_slots.size()].filename;
+  }
+
+  /**
+   * This method queues a file for reading.
+   *
+   * @param filename File to read.
+   * @return false if all buffers are in use.
+   */
+  bool submit(const std::string &filename) noexcept {
+    if (m_count == m_slots.size()) {
+      return false;
+    }
+    Slot &slot{m_slots[(m_head + m_count) % m_slots.size()]};
+    m_count++;
+    slot.filename = filename;
+    slot.size = slot.done = 0;
+    slot.error = 0;
+    slot.complete = false;
+#ifdef HAVE_IO_URING
+    if (0 <= m_ringFd) {
+      if (open(slot)) {
+        if (0 == slot.size) {
+          finish(slot);
+        } else {
+          slot.iov.iov_base = slot.buffer;
+          slot.iov.iov_len = readLength(slot, slot.size);
+          queue(slot);
+        }
+      }
+    }
+#endif
+    return true;
+  }
+
+  /**
+   * This method waits for the oldest file submitted; its contents remain
+   * valid until the next call.
+   *
+   * @param data Contents of the file.
+   * @param size Size of the file.
+   * @return 0 on success or an errno value.
+   */
+  int next(const unsigned char *&data, std::size_t &size) noexcept {
+    data = nullptr;
+    size = 0;
+    if (m_holding) {
+      m_head = (m_head + 1) % m_slots.size();
+      m_count--;
+      m_holding = false;
+    }
+    if (0 == m_count) {
+      return EINVAL;
+    }
+    Slot &slot{m_slots[m_head]};
+    m_holding = true;
+#ifdef HAVE_IO_URING
+    if (0 <= m_ringFd) {
+      flush();
+    }
+    while (slot.inFlight && reap(true)) {}
+    if (slot.inFlight) {
+      abandonRing();
+    }
+#endif
+    // Continue where io_uring stopped, if anywhere.
+    if (!slot.complete && ((0 <= slot.fd) || open(slot))) {
+      realign(slot, 0);
+      while ((slot.done < slot.size) && (0 == slot.error)) {
+        const std::size_t OFFSET{slot.done};
+        const ssize_t N{::pread(slot.fd, slot.buffer + OFFSET, readLength(slot, slot.size - OFFSET), static_cast<off_t>(OFFSET))};
+        if (0 < N) {
+          slot.done += static_cast<std::size_t>(N);
+          if (slot.done < slot.size) {
+            realign(slot, OFFSET);
+          }
+        } else if (0 == N) {
+          slot.size = slot.done;
+        } else if (EINTR != errno) {
+          slot.error = errno;
+        }
+      }
+      finish(slot);
+    }
+    if (0 == slot.error) {
+      data = slot.buffer;
+      size = slot.size;
+    }
+    return slot.error;
+  }
+
+ private:
+  std::size_t readLength(const Slot &slot, std::size_t size) const noexcept {
+    return slot.direct ? (size + READ_ALIGNMENT - 1) / READ_ALIGNMENT * READ_ALIGNMENT : size;
+  }
+
+  /**
+   * This method prepares the continuation of a short read, which O_DIRECT
+   * only accepts at aligned offsets: it restarts at the last aligned offset
+   * if that still makes progress, or switches the file to buffered reads.
+   *
+   * @param offset Offset of the read that came up short.
+   */
+  void realign(Slot &slot, std::size_t offset) noexcept {
+    if (!slot.direct || (0 == slot.done % READ_ALIGNMENT)) {
+      return;
+    }
+    const std::size_t ALIGNED{slot.done / READ_ALIGNMENT * READ_ALIGNMENT};
+    if (offset < ALIGNED) {
+      slot.done = ALIGNED;
+      return;
+    }
+    const int FLAGS{::fcntl(slot.fd, F_GETFL)};
+    if ((0 > FLAGS) || (0 != ::fcntl(slot.fd, F_SETFL, FLAGS & ~O_DIRECT))) {
+      slot.error = errno;
+    }
+    slot.direct = false;
+  }
+
+  /**
+   * This method opens the file of a slot and sizes its buffer.
+   *
+   * @return false if the slot finished with an error.
+   */
+  bool open(Slot &slot) noexcept {
+    slot.fd = -1;
+    if (m_direct) {
+      slot.fd = ::open(slot.filename.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    }
+    slot.direct = (0 <= slot.fd);
+    if (0 > slot.fd) {
+      // Not all file systems support O_DIRECT (e.g., tmpfs).
+      slot.fd = ::open(slot.filename.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    struct stat st;
+    if ((0 > slot.fd) || (0 != ::fstat(slot.fd, &st))) {
+      slot.error = errno;
+      finish(slot);
+      return false;
+    }
+    slot.size = static_cast<std::size_t>(st.st_size);
+    const std::size_t CAPACITY{(slot.size + READ_ALIGNMENT) / READ_ALIGNMENT * READ_ALIGNMENT};
+    if (slot.capacity < CAPACITY) {
+      if (nullptr != slot.buffer) {
+        ::munmap(slot.buffer, slot.capacity);
+      }
+      void *buffer{::mmap(nullptr, CAPACITY, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+      slot.buffer = (MAP_FAILED != buffer) ? static_cast<uint8_t*>(buffer) : nullptr;
+      slot.capacity = (MAP_FAILED != buffer) ? CAPACITY : 0;
+      if (nullptr == slot.buffer) {
+        slot.error = ENOMEM;
+        finish(slot);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void finish(Slot &slot) noexcept {
+    if (0 <= slot.fd) {
+      ::close(slot.fd);
+      slot.fd = -1;
+    }
+    slot.complete = true;
+  }
+
+#ifdef HAVE_IO_URING
+  void setupRing() noexcept {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    m_ringFd = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(m_slots.size()), &params));
+    if (0 > m_ringFd) {
+      // Not supported by the kernel or not permitted (e.g., seccomp in containers).
+      return;
+    }
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    m_cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+    m_sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+    if ((MAP_FAILED == m_sqRing) || (MAP_FAILED == m_cqRing) || (MAP_FAILED == m_sqes)) {
+      ::close(m_ringFd);
+      m_ringFd = -1;
+      return;
+    }
+    uint8_t *sq{static_cast<uint8_t*>(m_sqRing)};
+    uint8_t *cq{static_cast<uint8_t*>(m_cqRing)};
+    m_sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    m_cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  /**
+   * This method queues the read of a slot; it is submitted with the next flush.
+   */
+  void queue(Slot &slot) noexcept {
+    const uint32_t TAIL{__atomic_load_n(m_sqTail, __ATOMIC_RELAXED)};
+    const uint32_t INDEX{TAIL & m_sqMask};
+    struct io_uring_sqe *sqe{static_cast<struct io_uring_sqe*>(m_sqes) + INDEX};
+    std::memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.iov);
+    sqe->len = 1;
+    sqe->off = slot.done;
+    sqe->user_data = static_cast<uint64_t>(&slot - m_slots.data());
+    m_sqArray[INDEX] = INDEX;
+    __atomic_store_n(m_sqTail, TAIL + 1, __ATOMIC_RELEASE);
+    slot.inFlight = true;
+    m_inFlight++;
+    m_queued.push_back(static_cast<uint32_t>(sqe->user_data));
+  }
+
+  /**
+   * This method submits all queued reads with one system call. Reads that
+   * the kernel did not take are left to pread when their files are handed out.
+   */
+  void flush() noexcept {
+    if (m_queued.empty()) {
+      return;
+    }
+    const uint32_t COUNT{static_cast<uint32_t>(m_queued.size())};
+    long submitted{-1};
+    do {
+      submitted = ::syscall(__NR_io_uring_enter, m_ringFd, COUNT, 0, 0, nullptr, 0);
+    } while ((0 > submitted) && (EINTR == errno));
+    const uint32_t SUBMITTED{(0 < submitted) ? static_cast<uint32_t>(submitted) : 0};
+    if (SUBMITTED < COUNT) {
+      // Take the remaining entries back so that the next call does not submit
+      // them once the file is closed or the buffer reused.
+      __atomic_store_n(m_sqTail, __atomic_load_n(m_sqTail, __ATOMIC_RELAXED) - (COUNT - SUBMITTED), __ATOMIC_RELEASE);
+      for (uint32_t i{SUBMITTED}; i < COUNT; i++) {
+        m_slots[m_queued[i]].inFlight = false;
+        m_inFlight--;
+      }
+    }
+    m_queued.clear();
+  }
+
+  /**
+   * This method stops using the ring after waiting for it failed. Reads in
+   * flight may still complete; their buffers are given up instead of being
+   * reused, and their files are read again with pread.
+   */
+  void abandonRing() noexcept {
+    for (auto &slot : m_slots) {
+      if (slot.inFlight) {
+        slot.inFlight = false;
+        slot.buffer = nullptr;
+        slot.capacity = 0;
+        slot.size = slot.done = 0;
+        if (0 <= slot.fd) {
+          ::close(slot.fd);
+          slot.fd = -1;
+        }
+      }
+    }
+    m_inFlight = 0;
+    m_queued.clear();
+    closeRing();
+  }
+
+  void closeRing() noexcept {
+    if (MAP_FAILED != m_sqRing) {
+      ::munmap(m_sqRing, m_sqRingSize);
+      m_sqRing = MAP_FAILED;
+    }
+    if (MAP_FAILED != m_cqRing) {
+      ::munmap(m_cqRing, m_cqRingSize);
+      m_cqRing = MAP_FAILED;
+    }
+    if (MAP_FAILED != m_sqes) {
+      ::munmap(m_sqes, m_sqesSize);
+      m_sqes = MAP_FAILED;
+    }
+    if (0 <= m_ringFd) {
+      ::close(m_ringFd);
+      m_ringFd = -1;
+    }
+  }
+
+  /**
+   * This method processes completed reads.
+   *
+   * @param wait Block until at least one read completed.
+   * @return false if waiting failed.
+   */
+  bool reap(bool wait) noexcept {
+    if (wait && (__atomic_load_n(m_cqHead, __ATOMIC_RELAXED) == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))) {
+      if ((0 > ::syscall(__NR_io_uring_enter, m_ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0)) && (EINTR != errno)) {
+        return false;
+      }
+    }
+    uint32_t head{__atomic_load_n(m_cqHead, __ATOMIC_RELAXED)};
+    while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+      const struct io_uring_cqe &cqe{m_cqes[head & m_cqMask]};
+      Slot &slot{m_slots[cqe.user_data]};
+      const int32_t RESULT{cqe.res};
+      const std::size_t OFFSET{slot.done};
+      head++;
+      __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+      slot.inFlight = false;
+      m_inFlight--;
+      if (0 > RESULT) {
+        slot.error = -RESULT;
+      } else if (0 == RESULT) {
+        slot.size = slot.done;
+      } else {
+        slot.done += static_cast<std::size_t>(RESULT);
+      }
+      if ((0 == slot.error) && (slot.done < slot.size)) {
+        // Short read; continue with the remainder.
+        realign(slot, OFFSET);
+      }
+      if ((0 == slot.error) && (slot.done < slot.size)) {
+        slot.iov.iov_base = slot.buffer + slot.done;
+        slot.iov.iov_len = readLength(slot, slot.size - slot.done);
+        queue(slot);
+        continue;
+      }
+      if (slot.done > slot.size) {
+        slot.done = slot.size;
+      }
+      finish(slot);
+    }
+    // Submit the continuations of short reads; if not submitted, pread
+    // continues when the file is handed out.
+    flush();
+    return true;
+  }
+#endif
+
+ private:
+  std::vector<Slot> m_slots;
+  bool m_direct{false};
+  std::size_t m_head{0};
+  std::size_t m_count{0};
+  bool m_holding{false};
+#ifdef HAVE_IO_URING
+  int m_ringFd{-1};
+  uint32_t m_inFlight{0};
+  std::vector<uint32_t> m_queued{}; // Slots whose reads are queued but not submitted.
+  void *m_sqRing{MAP_FAILED};
+  void *m_cqRing{MAP_FAILED};
+  void *m_sqes{MAP_FAILED};
+  std::size_t m_sqRingSize{0};
+  std::size_t m_cqRingSize{0};
+  std::size_t m_sqesSize{0};
+  uint32_t *m_sqTail{nullptr};
+  uint32_t m_sqMask{0};
+  uint32_t *m_sqArray{nullptr};
+  uint32_t *m_cqHead{nullptr};
+  uint32_t *m_cqTail{nullptr};
+  uint32_t m_cqMask{0};
+  struct io_uring_cqe *m_cqes{nullptr};
+#endif
+};
+
+} // namespace ffe
+
+#endif
@@ -34,6 +34,11 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__) && !defined(LODEPNG_NO_SIMD_UNFILTER)
+#define LODEPNG_SIMD_UNFILTER /*SSE2 unfiltering of 8-bit RGB and RGBA scanlines*/
+#include <emmintrin.h>
+#endif /*__SSE2__ && !LODEPNG_NO_SIMD_UNFILTER*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -4025,6 +4030,98 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_SIMD_UNFILTER
+/*
+SSE2 unfiltering of 8-bit RGB and RGBA scanlines. Sub, Average and Paeth depend on the
+reconstructed pixel to the left, so the parallelism is across the 3 or 4 channels of one
+pixel rather than across pixels. The Paeth predictor is evaluated branch-free on 16-bit lanes.
+recon and scanline MAY be the same memory: each pixel is read before it is written.
+Only bytewidth 3 and 4 are used; fixed-size accesses keep the pixel in registers.
+*/
+static __m128i simdLoad(const unsigned char* p, size_t bytewidth)
+{
+  int v;
+  if(bytewidth == 4) memcpy(&v, p, 4);
+  else v = (int)((unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16));
+  return _mm_cvtsi32_si128(v);
+}
+
+static void simdStore(unsigned char* p, __m128i v, size_t bytewidth)
+{
+  unsigned t = (unsigned)_mm_cvtsi128_si32(v);
+  if(bytewidth == 4) memcpy(p, &t, 4);
+  else
+  {
+    p[0] = (unsigned char)t;
+    p[1] = (unsigned char)(t >> 8);
+    p[2] = (unsigned char)(t >> 16);
+  }
+}
+
+static void unfilterSubSIMD(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  size_t i;
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i != length; i += bytewidth)
+  {
+    a = _mm_add_epi8(a, simdLoad(&scanline[i], bytewidth));
+    simdStore(&recon[i], a, bytewidth);
+  }
+}
+
+static void unfilterAverageSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  for(i = 0; i != length; i += bytewidth)
+  {
+    __m128i b = simdLoad(&precon[i], bytewidth);
+    /*_mm_avg_epu8 rounds up, PNG rounds down*/
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(simdLoad(&scanline[i], bytewidth), avg);
+    simdStore(&recon[i], a, bytewidth);
+  }
+}
+
+static __m128i simdAbs16(__m128i x)
+{
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static __m128i simdSelect(__m128i mask, __m128i t, __m128i f)
+{
+  return _mm_or_si128(_mm_and_si128(mask, t), _mm_andnot_si128(mask, f));
+}
+
+static void unfilterPaethSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                              size_t bytewidth, size_t length)
+{
+  size_t i;
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, b = zero, c = zero;
+  for(i = 0; i != length; i += bytewidth)
+  {
+    __m128i pa, pb, pc, smallest, nearest, d;
+    c = b;
+    b = _mm_unpacklo_epi8(simdLoad(&precon[i], bytewidth), zero);
+    /*same tie-breaking as paethPredictor: a before b before c*/
+    pa = _mm_sub_epi16(b, c);
+    pb = _mm_sub_epi16(a, c);
+    pc = simdAbs16(_mm_add_epi16(pa, pb));
+    pa = simdAbs16(pa);
+    pb = simdAbs16(pb);
+    smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    nearest = simdSelect(_mm_cmpeq_epi16(smallest, pa), a, simdSelect(_mm_cmpeq_epi16(smallest, pb), b, c));
+    /*_epi8 on the 16-bit lanes wraps modulo 256 and keeps the high bytes zero*/
+    d = _mm_add_epi8(_mm_unpacklo_epi8(simdLoad(&scanline[i], bytewidth), zero), nearest);
+    simdStore(&recon[i], _mm_packus_epi16(d, d), bytewidth);
+    a = d;
+  }
+}
+#endif /*LODEPNG_SIMD_UNFILTER*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length)
 {
@@ -4038,6 +4135,27 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_SIMD_UNFILTER
+  /*for RGB, only Paeth gains over the scalar loops below*/
+  if(bytewidth == 4 && length % 4 == 0)
+  {
+    if(filterType == 1)
+    {
+      unfilterSubSIMD(recon, scanline, 4, length);
+      return 0;
+    }
+    if(filterType == 3 && precon)
+    {
+      unfilterAverageSIMD(recon, scanline, precon, 4, length);
+      return 0;
+    }
+  }
+  if((bytewidth == 3 || bytewidth == 4) && length % bytewidth == 0 && filterType == 4 && precon)
+  {
+    unfilterPaethSIMD(recon, scanline, precon, bytewidth, length);
+    return 0;
+  }
+#endif /*LODEPNG_SIMD_UNFILTER*/
   switch(filterType)
   {
     case 0:
@@ -4099,6 +4217,13 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline,
+                                   const unsigned char* precon, size_t bytewidth,
+                                   unsigned char filterType, size_t length)
+{
+  return unfilterScanline(recon, scanline, precon, bytewidth, filterType, length);
+}
+
 static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
 {
   /*
@@ -663,6 +663,17 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Reverses filter method 0 on one scanline, for decoders that inflate the IDAT stream
+themselves and process the image row by row. bytewidth is the number of bytes per pixel
+(at least 1), precon the previous unfiltered scanline or NULL for the first one, and
+length the number of bytes of the scanline without the filter type byte. recon and
+scanline may be the same memory; precon must be disjoint. Returns 0 or error 36.
+*/
+unsigned lodepng_unfilter_scanline(unsigned char* recon, const unsigned char* scanline,
+                                   const unsigned char* precon, size_t bytewidth,
+                                   unsigned char filterType, size_t length);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 
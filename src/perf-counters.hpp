@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Counter values of one group read.
+ */
+struct PerfSample {
+  enum : uint32_t { CYCLES = 0, INSTRUCTIONS, CACHE_REFERENCES, CACHE_MISSES, BRANCH_MISSES, COUNT };
+  uint64_t values[COUNT]{0, 0, 0, 0, 0};
+};
+
+/**
+ * Accumulated counters for one pipeline stage.
+ */
+struct PerfStageTotals {
+  uint64_t samples{0};
+  uint64_t values[PerfSample::COUNT]{0, 0, 0, 0, 0};
+};
+
+/**
+ * PerfCounters opens one perf_event group (cycles, instructions, LLC
+ * references and misses, branch misses) for the calling thread and sums up
+ * the counter deltas per named stage. Further groups can be attached to
+ * other threads, e.g., the workers of a WorkerPool that the calling thread
+ * waits for; their counters are added to those of the calling thread.
+ * Counters that cannot be opened (e.g., in containers or VMs without PMU
+ * access) are reported as unavailable.
+ */
+class PerfCounters {
+ private:
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters(PerfCounters &&)      = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+  PerfCounters &operator=(PerfCounters &&) = delete;
+
+  struct Group {
+    int leader{-1};
+    int fds[PerfSample::COUNT]{-1, -1, -1, -1, -1};
+    uint64_t ids[PerfSample::COUNT]{0, 0, 0, 0, 0};
+  };
+
+ public:
+  PerfCounters() noexcept
+    : m_groups(1)
+    , m_stages() {
+    open(m_groups[0], 0 /* this thread */);
+  }
+
+  ~PerfCounters() noexcept {
+    for (auto &group : m_groups) {
+      close(group);
+    }
+  }
+
+ public:
+  /**
+   * @return True if at least the cycle counter is available.
+   */
+  bool valid() const noexcept {
+    return -1 != m_groups[0].leader;
+  }
+
+  /**
+   * @return Reason why the counters are unavailable.
+   */
+  const std::string &error() const noexcept {
+    return m_error;
+  }
+
+  /**
+   * This method adds the counters of another thread of this process.
+   *
+   * @param tid Kernel id of the thread.
+   * @return false if the counters of the calling thread are unavailable or
+   *         the ones of the given thread could not be opened.
+   */
+  bool attach(pid_t tid) noexcept {
+    if (!valid()) {
+      return false;
+    }
+    Group group;
+    if (!open(group, tid)) {
+      return false;
+    }
+    // Sums are only meaningful over the same counters.
+    for (uint32_t i{0}; i < PerfSample::COUNT; i++) {
+      if ((-1 == group.fds[i]) != (-1 == m_groups[0].fds[i])) {
+        m_error = "counters differ between threads";
+        close(group);
+        return false;
+      }
+    }
+    m_groups.push_back(group);
+    return true;
+  }
+
+  /**
+   * This method marks a stage whose work is partly done by threads that
+   * are not counted; its summary line is flagged as incomplete.
+   *
+   * @param stage Name of the stage.
+   */
+  void incomplete(const char *stage) noexcept {
+    m_incomplete.insert(stage);
+  }
+
+  /**
+   * @return Current counter values summed over all groups.
+   */
+  PerfSample read() const noexcept {
+    PerfSample sample;
+    for (const auto &group : m_groups) {
+      // Layout for PERF_FORMAT_GROUP | PERF_FORMAT_ID: nr, then (value, id) pairs.
+      uint64_t buffer[1 + 2 * PerfSample::COUNT];
+      if ((-1 != group.leader) && (0 < ::read(group.leader, buffer, sizeof(buffer)))) {
+        for (uint64_t j{0}; (j < buffer[0]) && (j < PerfSample::COUNT); j++) {
+          for (uint32_t i{0}; i < PerfSample::COUNT; i++) {
+            if ((-1 != group.fds[i]) && (group.ids[i] == buffer[2 + 2 * j])) {
+              sample.values[i] += buffer[1 + 2 * j];
+            }
+          }
+        }
+      }
+    }
+    return sample;
+  }
+
+  /**
+   * This method adds the counter deltas since begin to the given stage.
+   *
+   * @param stage Name of the stage.
+   * @param begin Sample taken when the stage started.
+   */
+  void accumulate(const char *stage, const PerfSample &begin) noexcept {
+    if (valid()) {
+      const PerfSample end{read()};
+      auto it = m_stages.find(stage);
+      if (m_stages.end() == it) {
+        it = m_stages.emplace(stage, PerfStageTotals{}).first;
+        m_order.push_back(stage);
+      }
+      it->second.samples++;
+      for (uint32_t i{0}; i < PerfSample::COUNT; i++) {
+        it->second.values[i] += end.values[i] - begin.values[i];
+      }
+    }
+  }
+
+  /**
+   * @return Summary lines per stage with IPC and LLC miss rates.
+   */
+  std::vector<std::string> summary() const noexcept {
+    std::vector<std::string> lines;
+    if (!valid()) {
+      lines.push_back("perf;unavailable;" + m_error);
+      return lines;
+    }
+    for (const auto &name : m_order) {
+      const PerfStageTotals &t = m_stages.at(name);
+      const double N{static_cast<double>(t.samples)};
+      auto available = [this](uint32_t i) { return -1 != m_groups[0].fds[i]; };
+      auto perFrame = [&t, &available, N](uint32_t i) {
+        std::stringstream sstr;
+        if (available(i) && (0 < N)) {
+          sstr << std::fixed << std::setprecision(0) << static_cast<double>(t.values[i]) / N;
+        } else {
+          sstr << "n/a";
+        }
+        return sstr.str();
+      };
+      auto ratio = [&t, &available](uint32_t a, uint32_t b, double scale) {
+        std::stringstream sstr;
+        if (available(a) && available(b) && (0 < t.values[b])) {
+          sstr << std::fixed << std::setprecision(3) << scale * static_cast<double>(t.values[a]) / static_cast<double>(t.values[b]);
+        } else {
+          sstr << "n/a";
+        }
+        return sstr.str();
+      };
+      std::stringstream sstr;
+      sstr << "perf;" << name << ";frames;" << t.samples
+           << ";cycles/frame;" << perFrame(PerfSample::CYCLES)
+           << ";instructions/frame;" << perFrame(PerfSample::INSTRUCTIONS)
+           << ";IPC;" << ratio(PerfSample::INSTRUCTIONS, PerfSample::CYCLES, 1.0)
+           << ";LLC-misses/frame;" << perFrame(PerfSample::CACHE_MISSES)
+           << ";LLC-miss-rate;" << ratio(PerfSample::CACHE_MISSES, PerfSample::CACHE_REFERENCES, 1.0)
+           << ";LLC-MPKI;" << ratio(PerfSample::CACHE_MISSES, PerfSample::INSTRUCTIONS, 1000.0)
+           << ";branch-misses/frame;" << perFrame(PerfSample::BRANCH_MISSES);
+      if (0 < m_incomplete.count(name)) {
+        sstr << ";incomplete;1";
+      }
+      lines.push_back(sstr.str());
+    }
+    return lines;
+  }
+
+ private:
+  /**
+   * This method opens a group for the given thread; counters other than
+   * the cycle counter may be missing.
+   *
+   * @return false if the cycle counter could not be opened.
+   */
+  bool open(Group &group, pid_t tid) noexcept {
+    const uint64_t CONFIGS[PerfSample::COUNT]{PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                              PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+                                              PERF_COUNT_HW_BRANCH_MISSES};
+    for (uint32_t i{0}; i < PerfSample::COUNT; i++) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = CONFIGS[i];
+      attr.disabled = (-1 == group.leader) ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+      const int fd{static_cast<int>(::syscall(SYS_perf_event_open, &attr, tid, -1 /* any CPU */, group.leader, 0))};
+      if (-1 == fd) {
+        if (-1 == group.leader) {
+          m_error = ::strerror(errno);
+          return false;
+        }
+        continue;
+      }
+      if (-1 == group.leader) {
+        group.leader = fd;
+      }
+      group.fds[i] = fd;
+      ::ioctl(fd, PERF_EVENT_IOC_ID, &group.ids[i]);
+    }
+    ::ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ::ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+  }
+
+  static void close(Group &group) noexcept {
+    for (int &fd : group.fds) {
+      if (-1 != fd) {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    group.leader = -1;
+  }
+
+ private:
+  std::vector<Group> m_groups;
+  std::string m_error{""};
+  std::map<std::string, PerfStageTotals, std::less<>> m_stages;
+  std::vector<std::string> m_order{};
+  std::set<std::string, std::less<>> m_incomplete{};
+};
+
+/**
+ * @return Sample to pass to perfEnd or an empty sample when no counters are given.
+ */
+inline PerfSample perfBegin(const PerfCounters *counters) noexcept {
+  return (nullptr != counters) ? counters->read() : PerfSample{};
+}
+
+/**
+ * This function accumulates the counters since begin for the given stage.
+ */
+inline void perfEnd(PerfCounters *counters, const char *stage, const PerfSample &begin) noexcept {
+  if (nullptr != counters) {
+    counters->accumulate(stage, begin);
+  }
+}
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,533 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PNG_DECODER_HPP
+#define PNG_DECODER_HPP
+
+#include "lodepng.h"
+#include "frame-buffer-pool.hpp"
+
+#include <libyuv.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+#ifdef HAVE_ZLIB
+/**
+ * Size of the decompressed IDAT stream as predicted from the PNG header;
+ * passed to zlibInflate via LodePNGDecompressSettings::custom_context.
+ */
+struct InflateHint {
+  std::size_t expectedSize{0};
+};
+
+/**
+ * @return lodepng error code for a failed zlib inflate call.
+ */
+inline unsigned zlibError(const z_stream &stream, int result) noexcept {
+  if (Z_MEM_ERROR == result) {
+    return 83;
+  }
+  if (Z_DATA_ERROR == result) {
+    return ((nullptr != stream.msg) && (0 == std::strcmp(stream.msg, "incorrect data check"))) ? 58 : 16;
+  }
+  // Input ended before the stream.
+  return 23;
+}
+
+/**
+ * This function inflates a zlib stream with the system's zlib and is meant
+ * to be plugged into LodePNGDecompressSettings::custom_zlib; it honors
+ * ignore_adler32 by inflating the raw deflate stream without the trailer.
+ *
+ * @return 0 on success or a lodepng error code.
+ */
+inline unsigned zlibInflate(unsigned char **out, std::size_t *outsize, const unsigned char *in, std::size_t insize, const LodePNGDecompressSettings *settings) noexcept {
+  // Same header checks as lodepng's own inflate.
+  if (insize < 2) {
+    return 53;
+  }
+  if (0 != (((in[0] << 8) | in[1]) % 31)) {
+    return 24;
+  }
+  if ((8 != (in[0] & 0x0f)) || (7 < (in[0] >> 4))) {
+    return 25;
+  }
+  if (0 != (in[1] & 0x20)) {
+    return 26;
+  }
+
+  const bool RAW{0 != settings->ignore_adler32};
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(z_stream));
+  if (Z_OK != inflateInit2(&stream, RAW ? -MAX_WBITS : MAX_WBITS)) {
+    return 83;
+  }
+  stream.next_in = const_cast<unsigned char*>(RAW ? in + 2 : in);
+  stream.avail_in = static_cast<uInt>(RAW ? insize - 2 : insize);
+
+  // lodepng reserved exactly the predicted size; a little slack lets zlib
+  // consume the trailer without another round trip.
+  const InflateHint *hint{static_cast<const InflateHint*>(settings->custom_context)};
+  std::size_t capacity{*outsize + (((nullptr != hint) && (0 < hint->expectedSize)) ? hint->expectedSize + 64 : insize * 4 + 64)};
+  std::size_t size{*outsize};
+  int result{Z_OK};
+  unsigned char *buffer{static_cast<unsigned char*>(std::realloc(*out, capacity))};
+  if (nullptr == buffer) {
+    result = Z_MEM_ERROR;
+  } else {
+    *out = buffer;
+  }
+  while (Z_OK == result) {
+    if (size == capacity) {
+      buffer = static_cast<unsigned char*>(std::realloc(*out, capacity * 2));
+      if (nullptr == buffer) {
+        result = Z_MEM_ERROR;
+        break;
+      }
+      *out = buffer;
+      capacity *= 2;
+    }
+    const std::size_t AVAILABLE{capacity - size};
+    stream.next_out = *out + size;
+    stream.avail_out = static_cast<uInt>((AVAILABLE < std::numeric_limits<uInt>::max()) ? AVAILABLE : std::numeric_limits<uInt>::max());
+    const uInt BEFORE{stream.avail_out};
+    result = inflate(&stream, Z_NO_FLUSH);
+    size += BEFORE - stream.avail_out;
+  }
+  const unsigned error{(Z_STREAM_END == result) ? 0 : zlibError(stream, result)};
+  inflateEnd(&stream);
+  *outsize = size;
+  return error;
+}
+#endif
+
+/**
+ * A PngDecoder decodes PNG files while reusing its buffers and decoder state
+ * across frames. With HAVE_ZLIB, the inflate step runs in the system's zlib
+ * and 8-bit gray, RGB, and RGBA images are converted to i420 while
+ * streaming: scanlines are inflated and unfiltered in small batches and
+ * converted within the crop window while they are still in cache, without a
+ * full-frame buffer. Otherwise, these color types are decoded without
+ * expanding them to RGBA first.
+ */
+class PngDecoder {
+ private:
+  PngDecoder(const PngDecoder &) = delete;
+  PngDecoder(PngDecoder &&)      = delete;
+  PngDecoder &operator=(const PngDecoder &) = delete;
+  PngDecoder &operator=(PngDecoder &&) = delete;
+
+  // Scanlines per batch when streaming; even so that chroma rows pair up.
+  static constexpr uint32_t ROWS_PER_BATCH{16};
+
+ public:
+  // Error of toI420 if the crop window exceeds the image; lodepng's own
+  // error codes end below 1000.
+  static constexpr unsigned ERROR_CROP_WINDOW{1000};
+
+  /**
+   * Constructor.
+   *
+   * @param ignoreChecksums Skip CRC and Adler-32 verification for trusted files.
+   * @param fastInflate Use the system's zlib for inflating if available.
+   */
+  explicit PngDecoder(bool ignoreChecksums, bool fastInflate = true) noexcept
+    : m_state()
+    , m_file()
+    , m_raw()
+    , m_rows() {
+    // Y of gray as libyuv computes it for R = G = B so that gray frames match
+    // their RGB(A) counterparts exactly.
+    {
+      uint8_t rgba[256 * 4];
+      uint8_t u[128], v[128];
+      for (uint32_t i{0}; i < 256; i++) {
+        rgba[i * 4] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = static_cast<uint8_t>(i);
+        rgba[i * 4 + 3] = 0xff;
+      }
+      libyuv::ABGRToI420(rgba, 256 * 4, m_grayToY, 256, u, 128, v, 128, 256, 1);
+    }
+    m_state.decoder.ignore_crc = ignoreChecksums ? 1 : 0;
+    m_state.decoder.zlibsettings.ignore_adler32 = ignoreChecksums ? 1 : 0;
+#ifdef HAVE_ZLIB
+    if (fastInflate) {
+      m_state.decoder.zlibsettings.custom_zlib = &zlibInflate;
+      m_state.decoder.zlibsettings.custom_context = &m_hint;
+    }
+#else
+    (void)fastInflate;
+#endif
+  }
+
+  /**
+   * @return Name of the inflate backend in use.
+   */
+  const char *inflateBackend() const noexcept {
+    return (nullptr != m_state.decoder.zlibsettings.custom_zlib) ? "zlib" : "lodepng";
+  }
+
+  /**
+   * @param error Error code returned by a method of this class.
+   * @return Description of the error.
+   */
+  std::string errorText(unsigned error) const noexcept {
+    if (ERROR_CROP_WINDOW == error) {
+      return "crop window of " + std::to_string(m_crop[2]) + "x" + std::to_string(m_crop[3]) + " at (" + std::to_string(m_crop[0]) + ", "
+             + std::to_string(m_crop[1]) + ") exceeds the image of " + std::to_string(m_width) + "x" + std::to_string(m_height);
+    }
+    return lodepng_error_text(error);
+  }
+
+  /**
+   * This method decodes a PNG file to RGBA.
+   *
+   * @param rgba Destination; resized to width * height * 4.
+   * @param width Width of the decoded image.
+   * @param height Height of the decoded image.
+   * @param filename PNG file to decode.
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned decode(std::vector<unsigned char> &rgba, unsigned &width, unsigned &height, const std::string &filename) noexcept {
+    unsigned error{lodepng::load_file(m_file, filename)};
+    if (0 == error) {
+      error = decode(rgba, width, height, m_file.data(), m_file.size());
+    }
+    return error;
+  }
+
+  /**
+   * This method decodes a PNG image in memory to RGBA.
+   *
+   * @param rgba Destination; resized to width * height * 4.
+   * @param width Width of the decoded image.
+   * @param height Height of the decoded image.
+   * @param png PNG image.
+   * @param size Size of the PNG image.
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned decode(std::vector<unsigned char> &rgba, unsigned &width, unsigned &height, const unsigned char *png, std::size_t size) noexcept {
+    return decode(rgba, width, height, png, size, LCT_RGBA);
+  }
+
+  /**
+   * This method reads a PNG file into memory, e.g., to identify it by its
+   * contents before loading it from there.
+   *
+   * @param filename PNG file to read.
+   * @param png Contents; valid until the next file is read or loaded.
+   * @param size Size of the contents.
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned read(const std::string &filename, const unsigned char *&png, std::size_t &size) noexcept {
+    const unsigned error{lodepng::load_file(m_file, filename)};
+    png = (0 == error) ? m_file.data() : nullptr;
+    size = (0 == error) ? m_file.size() : 0;
+    return error;
+  }
+
+  /**
+   * This method reads a PNG file and its header for a subsequent toI420.
+   *
+   * @param filename PNG file to load.
+   * @param width Width of the image.
+   * @param height Height of the image.
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned load(const std::string &filename, unsigned &width, unsigned &height) noexcept {
+    unsigned error{lodepng::load_file(m_file, filename)};
+    if (0 == error) {
+      error = load(m_file.data(), m_file.size(), width, height);
+    }
+    return error;
+  }
+
+  /**
+   * This method inspects a PNG image in memory for a subsequent toI420; the
+   * memory must remain valid until then.
+   *
+   * @param png PNG image.
+   * @param size Size of the PNG image.
+   * @param width Width of the image.
+   * @param height Height of the image.
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned load(const unsigned char *png, std::size_t size, unsigned &width, unsigned &height) noexcept {
+    m_png = png;
+    m_pngSize = size;
+    unsigned error{lodepng_inspect(&width, &height, &m_state, png, size)};
+    m_width = (0 == error) ? width : 0;
+    m_height = (0 == error) ? height : 0;
+    return error;
+  }
+
+  /**
+   * This method decodes the loaded PNG image and converts the window at
+   * (cropX, cropY) of the size of the destination frame to i420.
+   *
+   * @param i420 Destination frame.
+   * @param cropX Left of the window.
+   * @param cropY Top of the window.
+   * @return 0 on success, ERROR_CROP_WINDOW, or a lodepng error code.
+   */
+  unsigned toI420(const FrameBuffer &i420, uint32_t cropX, uint32_t cropY) noexcept {
+    if ((0 == m_width) || (m_width < cropX + i420.width) || (m_height < cropY + i420.height)) {
+      m_crop[0] = cropX;
+      m_crop[1] = cropY;
+      m_crop[2] = i420.width;
+      m_crop[3] = i420.height;
+      return ERROR_CROP_WINDOW;
+    }
+    const LodePNGColorMode &color{m_state.info_png.color};
+    const bool NATIVE{(8 == color.bitdepth) && ((LCT_GREY == color.colortype) || (LCT_RGB == color.colortype) || (LCT_RGBA == color.colortype))};
+#ifdef HAVE_ZLIB
+    if (NATIVE && (nullptr != m_state.decoder.zlibsettings.custom_zlib) && (0 == m_state.info_png.interlace_method)) {
+      return streamToI420(i420, cropX, cropY);
+    }
+#endif
+    const LodePNGColorType COLORTYPE{NATIVE ? color.colortype : LCT_RGBA};
+    const uint32_t BYTEWIDTH{(LCT_GREY == COLORTYPE) ? 1u : ((LCT_RGB == COLORTYPE) ? 3u : 4u)};
+    unsigned width{0}, height{0};
+    unsigned error{decode(m_raw, width, height, m_png, m_pngSize, COLORTYPE)};
+    if (0 == error) {
+      convert(m_raw.data() + (static_cast<std::size_t>(cropY) * width + cropX) * BYTEWIDTH, width * BYTEWIDTH, BYTEWIDTH, i420, 0, i420.height);
+    }
+    return error;
+  }
+
+ private:
+  unsigned decode(std::vector<unsigned char> &raw, unsigned &width, unsigned &height, const unsigned char *png, std::size_t size, LodePNGColorType colortype) noexcept {
+    raw.clear();
+#ifdef HAVE_ZLIB
+    m_hint.expectedSize = 0;
+    if ((0 == lodepng_inspect(&width, &height, &m_state, png, size)) && (0 == m_state.info_png.interlace_method)) {
+      const std::size_t ROW{(static_cast<std::size_t>(width) * lodepng_get_bpp(&m_state.info_png.color) + 7) / 8};
+      m_hint.expectedSize = height * (1 + ROW);
+    }
+#endif
+    m_state.info_raw.colortype = colortype;
+    m_state.info_raw.bitdepth = 8;
+    return lodepng::decode(raw, width, height, m_state, png, size);
+  }
+
+  /**
+   * This method converts rows of 8-bit gray, RGB, or RGBA pixels to i420.
+   *
+   * @param src First pixel of the first row within the crop window.
+   * @param stride Bytes per source row.
+   * @param bytewidth Bytes per pixel (1, 3, 4).
+   * @param i420 Destination frame.
+   * @param row First destination row; even except for a single last row.
+   * @param rows Number of rows to convert.
+   */
+  void convert(const uint8_t *src, std::size_t stride, uint32_t bytewidth, const FrameBuffer &i420, uint32_t row, uint32_t rows) const noexcept {
+    uint8_t *dstY{i420.y() + row * static_cast<uint32_t>(i420.strides[0])};
+    uint8_t *dstU{i420.u() + (row / 2) * static_cast<uint32_t>(i420.strides[1])};
+    uint8_t *dstV{i420.v() + (row / 2) * static_cast<uint32_t>(i420.strides[2])};
+    if (4 == bytewidth) {
+      libyuv::ABGRToI420(src, static_cast<int>(stride), dstY, i420.strides[0], dstU, i420.strides[1], dstV, i420.strides[2],
+                         static_cast<int>(i420.width), static_cast<int>(rows));
+    } else if (3 == bytewidth) {
+      // libyuv calls R, G, B in memory order RAW.
+      libyuv::RAWToI420(src, static_cast<int>(stride), dstY, i420.strides[0], dstU, i420.strides[1], dstV, i420.strides[2],
+                        static_cast<int>(i420.width), static_cast<int>(rows));
+    } else {
+      for (uint32_t y{0}; y < rows; y++) {
+        const uint8_t *gray{src + y * stride};
+        uint8_t *Y{dstY + y * static_cast<uint32_t>(i420.strides[0])};
+        for (uint32_t x{0}; x < i420.width; x++) {
+          Y[x] = m_grayToY[gray[x]];
+        }
+      }
+      const uint32_t CW{(i420.width + 1) / 2};
+      for (uint32_t y{0}; y < (rows + 1) / 2; y++) {
+        std::memset(dstU + y * static_cast<uint32_t>(i420.strides[1]), 128, CW);
+        std::memset(dstV + y * static_cast<uint32_t>(i420.strides[2]), 128, CW);
+      }
+    }
+  }
+
+#ifdef HAVE_ZLIB
+  /**
+   * This method makes the next IDAT chunk the input of the stream.
+   *
+   * @return 0 on success, 23 if there is no further IDAT chunk, or 57 on a CRC mismatch.
+   */
+  unsigned nextIdat(z_stream &stream) noexcept {
+    const unsigned char *END{m_png + m_pngSize};
+    while ((nullptr != m_chunk) && (m_chunk + 12 <= END)) {
+      const unsigned char *chunk{m_chunk};
+      const unsigned LENGTH{lodepng_chunk_length(chunk)};
+      if (static_cast<std::size_t>(END - chunk) < 12 + static_cast<std::size_t>(LENGTH)) {
+        break;
+      }
+      m_chunk = lodepng_chunk_next_const(chunk);
+      if (lodepng_chunk_type_equals(chunk, "IEND")) {
+        break;
+      }
+      if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+        if ((0 == m_state.decoder.ignore_crc) && (0 != lodepng_chunk_check_crc(chunk))) {
+          return 57;
+        }
+        stream.next_in = const_cast<unsigned char*>(lodepng_chunk_data_const(chunk));
+        stream.avail_in = LENGTH;
+        // Raw inflate starts after the zlib header.
+        const uInt SKIP{(m_skip < stream.avail_in) ? m_skip : stream.avail_in};
+        stream.next_in += SKIP;
+        stream.avail_in -= SKIP;
+        m_skip -= SKIP;
+        if (0 < stream.avail_in) {
+          return 0;
+        }
+      }
+    }
+    m_chunk = nullptr;
+    return 23;
+  }
+
+  /**
+   * This method inflates exactly size bytes.
+   *
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned inflateExactly(z_stream &stream, unsigned char *dst, std::size_t size) noexcept {
+    stream.next_out = dst;
+    stream.avail_out = static_cast<uInt>(size);
+    while (0 < stream.avail_out) {
+      const int RESULT{inflate(&stream, Z_NO_FLUSH)};
+      if (Z_STREAM_END == RESULT) {
+        return (0 < stream.avail_out) ? 91 : 0;
+      }
+      if ((Z_OK != RESULT) && (Z_BUF_ERROR != RESULT)) {
+        return zlibError(stream, RESULT);
+      }
+      if ((0 < stream.avail_out) && (0 == stream.avail_in)) {
+        const unsigned error{nextIdat(stream)};
+        if (0 != error) {
+          return error;
+        }
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * This method inflates the remainder of the stream so that zlib verifies
+   * its Adler-32 and all IDAT chunks have their CRC checked.
+   *
+   * @return 0 on success or a lodepng error code.
+   */
+  unsigned drain(z_stream &stream, unsigned char *scratch, std::size_t size) noexcept {
+    for (;;) {
+      stream.next_out = scratch;
+      stream.avail_out = static_cast<uInt>(size);
+      const int RESULT{inflate(&stream, Z_NO_FLUSH)};
+      if (Z_STREAM_END == RESULT) {
+        return 0;
+      }
+      if ((Z_OK != RESULT) && (Z_BUF_ERROR != RESULT)) {
+        return zlibError(stream, RESULT);
+      }
+      if (0 == stream.avail_in) {
+        const unsigned error{nextIdat(stream)};
+        if (0 != error) {
+          return error;
+        }
+      }
+    }
+  }
+
+  unsigned streamToI420(const FrameBuffer &i420, uint32_t cropX, uint32_t cropY) noexcept {
+    const LodePNGColorType COLORTYPE{m_state.info_png.color.colortype};
+    const uint32_t BYTEWIDTH{(LCT_GREY == COLORTYPE) ? 1u : ((LCT_RGB == COLORTYPE) ? 3u : 4u)};
+    const std::size_t ROW{static_cast<std::size_t>(m_width) * BYTEWIDTH};
+    // Each slot holds one scanline starting at a 64-byte boundary with its
+    // filter type byte right before; slot 0 keeps the previous scanline.
+    const std::size_t SLOT{alignUp(static_cast<uint32_t>(ROW) + FRAME_BUFFER_ALIGNMENT, FRAME_BUFFER_ALIGNMENT)};
+    m_rows.resize(SLOT * (ROWS_PER_BATCH + 1) + FRAME_BUFFER_ALIGNMENT);
+    unsigned char *rows{m_rows.data() + FRAME_BUFFER_ALIGNMENT - (reinterpret_cast<uintptr_t>(m_rows.data()) % FRAME_BUFFER_ALIGNMENT)};
+
+    const bool RAW{0 != m_state.decoder.zlibsettings.ignore_adler32};
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(z_stream));
+    if (Z_OK != inflateInit2(&stream, RAW ? -MAX_WBITS : MAX_WBITS)) {
+      return 83;
+    }
+    m_chunk = m_png + 8;
+    m_skip = RAW ? 2 : 0;
+
+    unsigned error{0};
+    const uint32_t END{cropY + i420.height};
+    for (uint32_t y{0}; (0 == error) && (y < END);) {
+      // Scanlines above the window are only unfiltered as later ones depend on them.
+      const uint32_t N{std::min(ROWS_PER_BATCH, (y < cropY) ? cropY - y : END - y)};
+      for (uint32_t k{1}; (0 == error) && (k <= N); k++) {
+        unsigned char *row{rows + k * SLOT + FRAME_BUFFER_ALIGNMENT};
+        error = inflateExactly(stream, row - 1, ROW + 1);
+        if (0 == error) {
+          error = lodepng_unfilter_scanline(row, row, (0 == y + k - 1) ? nullptr : row - SLOT, BYTEWIDTH, row[-1], ROW);
+        }
+      }
+      if ((0 == error) && (cropY <= y)) {
+        convert(rows + SLOT + FRAME_BUFFER_ALIGNMENT + cropX * BYTEWIDTH, SLOT, BYTEWIDTH, i420, y - cropY, N);
+      }
+      std::memcpy(rows + FRAME_BUFFER_ALIGNMENT, rows + N * SLOT + FRAME_BUFFER_ALIGNMENT, ROW);
+      y += N;
+    }
+    // Without checksum verification, the scanlines below the window are skipped.
+    if ((0 == error) && !RAW) {
+      error = drain(stream, rows + FRAME_BUFFER_ALIGNMENT, SLOT - FRAME_BUFFER_ALIGNMENT);
+    }
+    inflateEnd(&stream);
+    m_chunk = nullptr;
+    return error;
+  }
+#endif
+
+ private:
+  lodepng::State m_state;
+  std::vector<unsigned char> m_file;
+  std::vector<unsigned char> m_raw;
+  uint8_t m_grayToY[256]{};
+  std::vector<unsigned char> m_rows;
+  const unsigned char *m_png{nullptr};
+  std::size_t m_pngSize{0};
+  unsigned m_width{0};
+  unsigned m_height{0};
+  // Crop window x, y, width, height of the last ERROR_CROP_WINDOW.
+  uint32_t m_crop[4]{0, 0, 0, 0};
+#ifdef HAVE_ZLIB
+  InflateHint m_hint{};
+  const unsigned char *m_chunk{nullptr};
+  uInt m_skip{0};
+#endif
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPORT_WRITER_HPP
+#define REPORT_WRITER_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Column of the per-frame rows of a report.
+ */
+struct ReportColumn {
+  enum class Type : uint8_t {
+    INTEGER = 0, // int64
+    REAL = 1,    // float64
+    STRING = 2,
+  };
+  std::string name{};
+  Type type{Type::INTEGER};
+  bool labelled{true}; // Text reports precede the value with the name.
+};
+
+/**
+ * Values of one per-frame row in the order of the columns; reused across
+ * frames to keep the capacity of its strings.
+ */
+class ReportRow {
+ public:
+  struct Value {
+    int64_t integer{0};
+    double real{0.0};
+    std::string text{};
+  };
+
+  ReportRow() noexcept
+    : m_values() {}
+
+  void clear() noexcept {
+    m_size = 0;
+  }
+
+  ReportRow &add(int64_t value) noexcept {
+    next().integer = value;
+    return *this;
+  }
+
+  ReportRow &add(double value) noexcept {
+    next().real = value;
+    return *this;
+  }
+
+  ReportRow &add(const std::string &value) noexcept {
+    next().text = value;
+    return *this;
+  }
+
+  std::size_t size() const noexcept {
+    return m_size;
+  }
+
+  const Value &operator[](std::size_t i) const noexcept {
+    return m_values[i];
+  }
+
+ private:
+  Value &next() noexcept {
+    if (m_size == m_values.size()) {
+      m_values.emplace_back();
+    }
+    return m_values[m_size++];
+  }
+
+ private:
+  std::vector<Value> m_values;
+  std::size_t m_size{0};
+};
+
+/**
+ * A ReportWriter collects the lines and per-frame rows of a report in memory
+ * and writes them in large blocks from its own thread, at the latest every
+ * second, so that the evaluation loop never waits for the file system.
+ *
+ * Text reports keep the semicolon-separated lines. Binary reports are
+ * columnar and start with a schema, all numbers in little endian:
+ *
+ *   "FFERPT1\n", uint32 number of columns, per column: uint8 type
+ *   (0: int64, 1: float64, 2: string), uint8 length of name, name
+ *
+ * followed by records starting with one byte:
+ *
+ *   'T': uint32 length, text of a line such as a summary
+ *   'B': uint32 number of rows n, then per column either n int64 or n
+ *        float64 values, or for strings n + 1 uint32 offsets followed by
+ *        the concatenated strings
+ */
+class ReportWriter {
+ private:
+  ReportWriter(const ReportWriter &) = delete;
+  ReportWriter(ReportWriter &&)      = delete;
+  ReportWriter &operator=(const ReportWriter &) = delete;
+  ReportWriter &operator=(ReportWriter &&) = delete;
+
+  static constexpr std::size_t BLOCK_SIZE_BYTES{1024 * 1024};
+  static constexpr uint32_t BLOCK_ROWS{4096};
+
+ public:
+  enum class Format : uint8_t {
+    TEXT,
+    BINARY,
+  };
+
+  /**
+   * @param name Name of the format (text, binary).
+   * @param format Resulting format.
+   * @return true if name denotes a known format.
+   */
+  static bool parse(const std::string &name, Format &format) noexcept {
+    if ("text" == name) {
+      format = Format::TEXT;
+    } else if ("binary" == name) {
+      format = Format::BINARY;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param filename File to create.
+   * @param format Format of the report.
+   * @param columns Columns of the per-frame rows.
+   */
+  ReportWriter(const std::string &filename, Format format, const std::vector<ReportColumn> &columns) noexcept
+    : m_format(format)
+    , m_columns(columns)
+    , m_buffer()
+    , m_integers(columns.size())
+    , m_reals(columns.size())
+    , m_offsets(columns.size())
+    , m_strings(columns.size())
+    , m_mutex()
+    , m_wakeUp()
+    , m_thread() {
+    m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (0 > m_fd) {
+      return;
+    }
+    m_buffer.reserve(2 * BLOCK_SIZE_BYTES);
+    if (Format::BINARY == m_format) {
+      m_buffer.append("FFERPT1\n");
+      put(static_cast<uint32_t>(m_columns.size()));
+      for (const auto &column : m_columns) {
+        m_buffer.push_back(static_cast<char>(column.type));
+        m_buffer.push_back(static_cast<char>(std::min<std::size_t>(255, column.name.size())));
+        m_buffer.append(column.name, 0, 255);
+      }
+      clearBlock();
+    }
+    m_thread = std::thread(&ReportWriter::run, this);
+  }
+
+  ~ReportWriter() noexcept {
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      m_running = false;
+    }
+    m_wakeUp.notify_one();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    if (0 <= m_fd) {
+      ::close(m_fd);
+    }
+  }
+
+  /**
+   * @return False if the file could not be created or written.
+   */
+  bool valid() const noexcept {
+    return (0 <= m_fd) && !m_failed;
+  }
+
+  /**
+   * This function formats a row as in text reports, e.g., for the console.
+   *
+   * @param columns Columns of the report.
+   * @param row Row matching the columns.
+   * @return Row as text without line break.
+   */
+  static std::string toText(const std::vector<ReportColumn> &columns, const ReportRow &row) noexcept {
+    std::string line{"[frame-feed-evaluator]: "};
+    appendText(line, columns, row);
+    return line;
+  }
+
+  /**
+   * This method appends a line of text, e.g., a summary.
+   *
+   * @param line Text without line break.
+   */
+  void text(const std::string &line) noexcept {
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      if (Format::TEXT == m_format) {
+        m_buffer.append(line).push_back('\n');
+      } else {
+        // Rows before the line stay before it.
+        serializeBlock();
+        m_buffer.push_back('T');
+        put(static_cast<uint32_t>(line.size()));
+        m_buffer.append(line);
+      }
+    }
+  }
+
+  /**
+   * This method appends a per-frame row.
+   *
+   * @param row Row matching the columns.
+   */
+  void append(const ReportRow &row) noexcept {
+    bool full{false};
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      if (Format::TEXT == m_format) {
+        m_buffer.append("[frame-feed-evaluator]: ");
+        appendText(m_buffer, m_columns, row);
+        m_buffer.push_back('\n');
+      } else {
+        // Missing values are zero so that all columns keep the same length.
+        const ReportRow::Value EMPTY{};
+        for (std::size_t i{0}; i < m_columns.size(); i++) {
+          const ReportRow::Value &value{(i < row.size()) ? row[i] : EMPTY};
+          switch (m_columns[i].type) {
+            case ReportColumn::Type::INTEGER: m_integers[i].push_back(value.integer); break;
+            case ReportColumn::Type::REAL: m_reals[i].push_back(value.real); break;
+            case ReportColumn::Type::STRING:
+              m_strings[i].append(value.text);
+              m_offsets[i].push_back(static_cast<uint32_t>(m_strings[i].size()));
+              break;
+          }
+        }
+        if (BLOCK_ROWS <= ++m_blockRows) {
+          serializeBlock();
+        }
+      }
+      full = (BLOCK_SIZE_BYTES <= m_buffer.size());
+    }
+    if (full) {
+      m_wakeUp.notify_one();
+    }
+  }
+
+ private:
+  void run() noexcept {
+    std::string pending;
+    pending.reserve(2 * BLOCK_SIZE_BYTES);
+    bool running{true};
+    while (running) {
+      {
+        std::unique_lock<std::mutex> lck(m_mutex);
+        m_wakeUp.wait_for(lck, std::chrono::seconds(1), [this]{
+          return !m_running || (BLOCK_SIZE_BYTES <= m_buffer.size());
+        });
+        running = m_running;
+        serializeBlock();
+        std::swap(pending, m_buffer);
+      }
+      std::size_t written{0};
+      while (!m_failed && (written < pending.size())) {
+        const ssize_t N{::write(m_fd, pending.data() + written, pending.size() - written)};
+        if (0 > N) {
+          m_failed = (EINTR != errno);
+          continue;
+        }
+        written += static_cast<std::size_t>(N);
+      }
+      pending.clear();
+    }
+  }
+
+  static void appendText(std::string &line, const std::vector<ReportColumn> &columns, const ReportRow &row) noexcept {
+    char number[32];
+    for (std::size_t i{0}; (i < columns.size()) && (i < row.size()); i++) {
+      if (0 < i) {
+        line.push_back(';');
+      }
+      if (columns[i].labelled) {
+        line.append(columns[i].name).push_back(';');
+      }
+      switch (columns[i].type) {
+        case ReportColumn::Type::INTEGER:
+          std::snprintf(number, sizeof(number), "%lld", static_cast<long long>(row[i].integer));
+          line.append(number);
+          break;
+        case ReportColumn::Type::REAL:
+          std::snprintf(number, sizeof(number), "%g", row[i].real);
+          line.append(number);
+          break;
+        case ReportColumn::Type::STRING:
+          line.append(row[i].text);
+          break;
+      }
+    }
+  }
+
+  template <typename T>
+  void put(const T &value) noexcept {
+    m_buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  void put(const std::vector<T> &values) noexcept {
+    m_buffer.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+  }
+
+  // Both called with m_mutex held.
+  void serializeBlock() noexcept {
+    if ((Format::BINARY != m_format) || (0 == m_blockRows)) {
+      return;
+    }
+    m_buffer.push_back('B');
+    put(m_blockRows);
+    for (std::size_t i{0}; i < m_columns.size(); i++) {
+      switch (m_columns[i].type) {
+        case ReportColumn::Type::INTEGER: put(m_integers[i]); break;
+        case ReportColumn::Type::REAL: put(m_reals[i]); break;
+        case ReportColumn::Type::STRING:
+          put(m_offsets[i]);
+          m_buffer.append(m_strings[i]);
+          break;
+      }
+    }
+    clearBlock();
+  }
+
+  void clearBlock() noexcept {
+    for (std::size_t i{0}; i < m_columns.size(); i++) {
+      m_integers[i].clear();
+      m_reals[i].clear();
+      m_offsets[i].assign(1, 0);
+      m_strings[i].clear();
+    }
+    m_blockRows = 0;
+  }
+
+ private:
+  Format m_format{Format::TEXT};
+  std::vector<ReportColumn> m_columns;
+  int m_fd{-1};
+  std::string m_buffer;
+  // Columns of the rows not yet serialized into m_buffer.
+  std::vector<std::vector<int64_t>> m_integers;
+  std::vector<std::vector<double>> m_reals;
+  std::vector<std::vector<uint32_t>> m_offsets;
+  std::vector<std::string> m_strings;
+  uint32_t m_blockRows{0};
+  std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  bool m_running{true};
+  std::atomic<bool> m_failed{false};
+  std::thread m_thread;
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROI_METRICS_HPP
+#define ROI_METRICS_HPP
+
+#include "frame-buffer-pool.hpp"
+#include "frame-metrics.hpp"
+#include "worker-pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * Rectangular region of interest of a frame with its weight.
+ */
+struct Roi {
+  uint32_t x{0};
+  uint32_t y{0};
+  uint32_t width{0};
+  uint32_t height{0};
+  double weight{1.0};
+};
+
+/**
+ * RoiMetrics compute PSNR and SSIM of source and result inside regions of
+ * interest only, one region per task of a WorkerPool, and combine them by
+ * weight: PSNR from the weighted squared errors, SSIM as weighted mean.
+ * Regions start at even coordinates so that they cover whole chroma samples.
+ */
+class RoiMetrics {
+ private:
+  RoiMetrics(const RoiMetrics &) = delete;
+  RoiMetrics(RoiMetrics &&)      = delete;
+  RoiMetrics &operator=(const RoiMetrics &) = delete;
+  RoiMetrics &operator=(RoiMetrics &&) = delete;
+
+ public:
+  /**
+   * @param spec Region as x,y,w,h or x,y,w,h,weight with integral x,y,w,h.
+   * @param roi Resulting region.
+   * @return true if spec denotes a non-empty region with positive weight.
+   */
+  static bool parse(const std::string &spec, Roi &roi) noexcept {
+    std::stringstream sstr{spec};
+    std::vector<double> values;
+    std::string value;
+    while (std::getline(sstr, value, ',')) {
+      try {
+        std::size_t pos{0};
+        values.push_back(std::stod(value, &pos));
+        if (value.size() != pos) {
+          return false;
+        }
+      } catch (...) {
+        return false;
+      }
+    }
+    if ((4 != values.size()) && (5 != values.size())) {
+      return false;
+    }
+    for (uint32_t i{0}; i < 4; i++) {
+      const double V{values[i]};
+      if (!((0 <= V) && (std::numeric_limits<uint32_t>::max() >= V) && (std::floor(V) >= V))) {
+        return false;
+      }
+    }
+    if ((1 > values[2]) || (1 > values[3])) {
+      return false;
+    }
+    roi.x = static_cast<uint32_t>(values[0]);
+    roi.y = static_cast<uint32_t>(values[1]);
+    roi.width = static_cast<uint32_t>(values[2]);
+    roi.height = static_cast<uint32_t>(values[3]);
+    roi.weight = (5 == values.size()) ? values[4] : 1.0;
+    return (0 < roi.weight) && std::isfinite(roi.weight);
+  }
+
+  /**
+   * This method moves a region to even coordinates so that it covers whole
+   * chroma samples.
+   *
+   * @param roi Region to align.
+   * @return true if the region was moved.
+   */
+  static bool align(Roi &roi) noexcept {
+    const Roi ORIGINAL{roi};
+    roi.x &= ~1u;
+    roi.y &= ~1u;
+    return (ORIGINAL.x != roi.x) || (ORIGINAL.y != roi.y);
+  }
+
+  /**
+   * Constructor.
+   *
+   * @param rois Regions of interest.
+   * @param workers Threads to compute the regions on; nullptr for the calling one.
+   */
+  RoiMetrics(const std::vector<Roi> &rois, WorkerPool *workers) noexcept
+    : m_rois(rois)
+    , m_workers(workers)
+    , m_metrics()
+    , m_sources(rois.size())
+    , m_results(rois.size()) {
+    // Each region is a task on its own; hence, the regions are not split.
+    for (std::size_t i{0}; i < m_rois.size(); i++) {
+      align(m_rois[i]);
+      m_metrics.emplace_back(new FrameMetrics{FrameMetrics::METRIC_PSNR | FrameMetrics::METRIC_SSIM, nullptr});
+    }
+  }
+
+  std::size_t size() const noexcept {
+    return m_rois.size();
+  }
+
+  /**
+   * This method clips the regions to the frames.
+   *
+   * @param width Width of the frames.
+   * @param height Height of the frames.
+   * @return false if a region lies outside of the frames.
+   */
+  bool clip(uint32_t width, uint32_t height) noexcept {
+    bool retVal{true};
+    for (auto &roi : m_rois) {
+      if ((roi.x >= width) || (roi.y >= height)) {
+        roi.width = roi.height = 0;
+        retVal = false;
+        continue;
+      }
+      roi.width = std::min(roi.width, width - roi.x);
+      roi.height = std::min(roi.height, height - roi.y);
+    }
+    return retVal;
+  }
+
+  /**
+   * This method compares two frames inside all regions.
+   *
+   * @param source Original frame.
+   * @param result Decoded frame.
+   * @param shortcut How FrameMetrics handled the whole frames.
+   */
+  void compute(const FrameBuffer &source, const FrameBuffer &result, FrameMetrics::Shortcut shortcut = FrameMetrics::Shortcut::NONE) noexcept {
+    if (FrameMetrics::Shortcut::REPEATED == shortcut) {
+      return;
+    }
+    auto task = [this, &source, &result, shortcut](uint32_t i) {
+      const Roi &ROI{m_rois[i]};
+      if (empty(i)) {
+        return;
+      }
+      if (FrameMetrics::Shortcut::IDENTICAL == shortcut) {
+        m_metrics[i]->identical(ROI.width, ROI.height);
+        return;
+      }
+      m_metrics[i]->compute(view(source, ROI, m_sources[i]), view(result, ROI, m_results[i]), ROI.width, ROI.height);
+    };
+    if (nullptr != m_workers) {
+      m_workers->parallelFor(static_cast<uint32_t>(m_rois.size()), task);
+    } else {
+      for (uint32_t i{0}; i < m_rois.size(); i++) {
+        task(i);
+      }
+    }
+  }
+
+  /**
+   * @return True if region i lies outside of the frames and is not computed.
+   */
+  bool empty(std::size_t i) const noexcept {
+    return (0 == m_rois[i].width) || (0 == m_rois[i].height);
+  }
+
+  const FrameMetrics &operator[](std::size_t i) const noexcept {
+    return *m_metrics[i];
+  }
+
+  /**
+   * @return PSNR of all regions from their squared errors weighted per sample.
+   */
+  double psnr() const noexcept {
+    double sse{0.0}, samples{0.0};
+    for (std::size_t i{0}; i < m_rois.size(); i++) {
+      for (uint32_t p{0}; p < 3; p++) {
+        sse += m_rois[i].weight * static_cast<double>((*m_metrics[i])[p].sse);
+        samples += m_rois[i].weight * static_cast<double>((*m_metrics[i])[p].samples);
+      }
+    }
+    if ((0.0 >= sse) || (0.0 >= samples)) {
+      return FrameMetrics::MAX_PSNR;
+    }
+    return std::min(FrameMetrics::MAX_PSNR, 10.0 * std::log10(255.0 * 255.0 * samples / sse));
+  }
+
+  /**
+   * @return SSIM of all regions as mean weighted per region.
+   */
+  double ssim() const noexcept {
+    double ssim{0.0}, weights{0.0};
+    for (std::size_t i{0}; i < m_rois.size(); i++) {
+      if (!empty(i)) {
+        ssim += m_rois[i].weight * m_metrics[i]->ssim();
+        weights += m_rois[i].weight;
+      }
+    }
+    return (0.0 < weights) ? ssim / weights : 1.0;
+  }
+
+ private:
+  static const FrameBuffer &view(const FrameBuffer &frame, const Roi &roi, FrameBuffer &dst) noexcept {
+    dst = frame;
+    dst.width = roi.width;
+    dst.height = roi.height;
+    dst.planes[0] = frame.planes[0] + static_cast<std::ptrdiff_t>(roi.y) * frame.strides[0] + roi.x;
+    dst.planes[1] = frame.planes[1] + static_cast<std::ptrdiff_t>(roi.y / 2) * frame.strides[1] + roi.x / 2;
+    dst.planes[2] = frame.planes[2] + static_cast<std::ptrdiff_t>(roi.y / 2) * frame.strides[2] + roi.x / 2;
+    return dst;
+  }
+
+ private:
+  std::vector<Roi> m_rois;
+  WorkerPool *m_workers{nullptr};
+  std::vector<std::unique_ptr<FrameMetrics>> m_metrics;
+  // Views of the regions per task.
+  std::vector<FrameBuffer> m_sources;
+  std::vector<FrameBuffer> m_results;
+};
+
+} // namespace ffe
+
+#endif
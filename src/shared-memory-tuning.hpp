@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARED_MEMORY_TUNING_HPP
+#define SHARED_MEMORY_TUNING_HPP
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace ffe {
+
+/**
+ * Placement options for the shared i420 frame region.
+ */
+struct SharedMemoryTuning {
+  bool hugePages{false}; // Ask for transparent huge pages on the shmem mapping.
+  int32_t numaNode{-1};  // Bind the pages to this NUMA node; -1 leaves the placement to the kernel.
+  bool prefault{false};  // Fault in all pages upfront.
+};
+
+/**
+ * What could actually be applied; every step degrades silently on kernels
+ * or containers that do not support it.
+ */
+struct SharedMemoryTuningResult {
+  bool hugePages{false};
+  bool numaBound{false};
+  bool prefaulted{false};
+};
+
+/**
+ * This function applies huge page, NUMA and prefault settings to an already
+ * created shared memory mapping. The region itself is owned by
+ * cluon::SharedMemory so that encoders can still attach to it by name; hence,
+ * MAP_HUGETLB is not an option and MADV_HUGEPAGE is used instead, which takes
+ * effect when /sys/kernel/mm/transparent_hugepage/shmem_enabled permits it.
+ *
+ * The NUMA policy is set before prefaulting so that the pages are allocated
+ * on the requested node right away; pages touched earlier are migrated.
+ *
+ * @param data Pointer to the user accessible part of the mapping.
+ * @param size Size of the user accessible part of the mapping.
+ * @param tuning Settings to apply.
+ * @return Settings that were applied successfully.
+ */
+inline SharedMemoryTuningResult tuneSharedMemory(char *data, std::size_t size, const SharedMemoryTuning &tuning) noexcept {
+  SharedMemoryTuningResult result;
+  if ((nullptr == data) || (0 == size)) {
+    return result;
+  }
+
+  // madvise and mbind expect page aligned ranges.
+  const std::size_t pageSize{static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))};
+  const uintptr_t begin{reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1)};
+  const uintptr_t end{(reinterpret_cast<uintptr_t>(data) + size + pageSize - 1) & ~(pageSize - 1)};
+  void *alignedBegin{reinterpret_cast<void *>(begin)};
+  const std::size_t alignedSize{end - begin};
+
+  if (0 <= tuning.numaNode) {
+    constexpr std::size_t BITS_PER_WORD{sizeof(unsigned long) * 8};
+    unsigned long nodeMask[16];
+    std::memset(nodeMask, 0, sizeof(nodeMask));
+    const std::size_t node{static_cast<std::size_t>(tuning.numaNode)};
+    if (node < sizeof(nodeMask) * 8) {
+      nodeMask[node / BITS_PER_WORD] |= (1UL << (node % BITS_PER_WORD));
+      result.numaBound = (0 == ::syscall(SYS_mbind, alignedBegin, alignedSize, MPOL_BIND, nodeMask, sizeof(nodeMask) * 8, MPOL_MF_MOVE));
+    }
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (tuning.hugePages) {
+    result.hugePages = (0 == ::madvise(alignedBegin, alignedSize, MADV_HUGEPAGE));
+  }
+#endif
+
+  if (tuning.prefault) {
+#ifdef MADV_POPULATE_WRITE
+    result.prefaulted = (0 == ::madvise(alignedBegin, alignedSize, MADV_POPULATE_WRITE));
+#endif
+    if (!result.prefaulted) {
+      // Fallback for kernels before 5.14: write to each page of the user
+      // accessible part; the header page is already populated by its owner.
+      volatile char *p{data};
+      for (std::size_t i{0}; i < size; i += pageSize) {
+        p[i] = 0;
+      }
+      result.prefaulted = true;
+    }
+  }
+  return result;
+}
+
+} // namespace ffe
+
+#endif
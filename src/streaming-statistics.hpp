@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAMING_STATISTICS_HPP
+#define STREAMING_STATISTICS_HPP
+
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A LogHistogram counts non-negative values in buckets whose width grows
+ * with the value (256 per power of two, i.e., 0.2% relative error) from
+ * 2^-40 to 2^40; smaller values count as 0 and larger ones as infinity.
+ */
+class LogHistogram {
+ private:
+  static constexpr int32_t SUB_BUCKETS{256};
+  static constexpr int32_t MIN_EXPONENT{-40};
+  static constexpr int32_t MAX_EXPONENT{40};
+  static constexpr std::size_t BUCKETS{2 + (MAX_EXPONENT - MIN_EXPONENT) * SUB_BUCKETS};
+
+ public:
+  LogHistogram() noexcept
+    : m_counts(BUCKETS, 0) {}
+
+  void add(double value) noexcept {
+    m_counts[index(value)]++;
+    m_count++;
+  }
+
+  void reset() noexcept {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_count = 0;
+  }
+
+  /**
+   * @param p Fraction of values below the result, from 0 to 1.
+   * @return Approximate percentile or NaN if empty.
+   */
+  double percentile(double p) const noexcept {
+    if (0 == m_count) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    const uint64_t RANK{std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * static_cast<double>(m_count))))};
+    uint64_t seen{0};
+    for (std::size_t i{0}; i < BUCKETS; i++) {
+      seen += m_counts[i];
+      if (seen >= RANK) {
+        return value(i);
+      }
+    }
+    return value(BUCKETS - 1);
+  }
+
+ private:
+  static std::size_t index(double v) noexcept {
+    if (!(v >= std::ldexp(1.0, MIN_EXPONENT))) {
+      return 0;
+    }
+    if (!(v < std::ldexp(1.0, MAX_EXPONENT))) {
+      return BUCKETS - 1;
+    }
+    int32_t e{0};
+    const double M{std::frexp(v, &e)}; // v = M * 2^e with M in [0.5, 1).
+    const int32_t SUB{std::min(SUB_BUCKETS - 1, static_cast<int32_t>((M * 2.0 - 1.0) * SUB_BUCKETS))};
+    return static_cast<std::size_t>(1 + (e - 1 - MIN_EXPONENT) * SUB_BUCKETS + SUB);
+  }
+
+  static double value(std::size_t i) noexcept {
+    if (0 == i) {
+      return 0.0;
+    }
+    if (BUCKETS - 1 == i) {
+      return std::numeric_limits<double>::infinity();
+    }
+    const int32_t E{static_cast<int32_t>(i - 1) / SUB_BUCKETS + MIN_EXPONENT};
+    const int32_t SUB{static_cast<int32_t>(i - 1) % SUB_BUCKETS};
+    // Center of the bucket.
+    return std::ldexp(1.0 + (SUB + 0.5) / SUB_BUCKETS, E);
+  }
+
+ private:
+  std::vector<uint32_t> m_counts;
+  uint64_t m_count{0};
+};
+
+/**
+ * StreamingStatistics summarize a series of values in constant memory: mean
+ * and variance (Welford), minimum, maximum, and approximate percentiles.
+ * Infinite values are excluded from mean and variance but count for minimum,
+ * maximum, and percentiles.
+ */
+class StreamingStatistics {
+ public:
+  /**
+   * @param nearOne Values approach 1 from below (e.g., SSIM); their distance
+   *        to 1 is resolved instead of the value itself.
+   */
+  explicit StreamingStatistics(bool nearOne = false) noexcept
+    : m_nearOne(nearOne)
+    , m_histogram() {}
+
+  void add(double value) noexcept {
+    m_count++;
+    m_minimum = std::min(m_minimum, value);
+    m_maximum = std::max(m_maximum, value);
+    m_histogram.add(m_nearOne ? 1.0 - value : value);
+    if (std::isfinite(value)) {
+      m_finite++;
+      const double DELTA{value - m_mean};
+      m_mean += DELTA / static_cast<double>(m_finite);
+      m_m2 += DELTA * (value - m_mean);
+    }
+  }
+
+  void reset() noexcept {
+    m_count = m_finite = 0;
+    m_mean = m_m2 = 0.0;
+    m_minimum = std::numeric_limits<double>::infinity();
+    m_maximum = -std::numeric_limits<double>::infinity();
+    m_histogram.reset();
+  }
+
+  uint64_t count() const noexcept {
+    return m_count;
+  }
+
+  double mean() const noexcept {
+    return (0 < m_finite) ? m_mean : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  double variance() const noexcept {
+    return (1 < m_finite) ? m_m2 / static_cast<double>(m_finite - 1) : 0.0;
+  }
+
+  double minimum() const noexcept {
+    return m_minimum;
+  }
+
+  double maximum() const noexcept {
+    return m_maximum;
+  }
+
+  /**
+   * @param p Fraction of values below the result, from 0 to 1.
+   * @return Approximate percentile.
+   */
+  double percentile(double p) const noexcept {
+    return m_nearOne ? 1.0 - m_histogram.percentile(1.0 - p) : m_histogram.percentile(p);
+  }
+
+  /**
+   * @return Summary as semicolon-separated names and values.
+   */
+  std::string toString() const noexcept {
+    std::stringstream sstr;
+    sstr << "count;" << m_count << ";mean;" << mean() << ";stddev;" << std::sqrt(variance())
+         << ";min;" << minimum() << ";p1;" << percentile(0.01) << ";p5;" << percentile(0.05)
+         << ";p50;" << percentile(0.5) << ";p95;" << percentile(0.95) << ";p99;" << percentile(0.99)
+         << ";max;" << maximum();
+    return sstr.str();
+  }
+
+ private:
+  bool m_nearOne{false};
+  uint64_t m_count{0};
+  uint64_t m_finite{0};
+  double m_mean{0.0};
+  double m_m2{0.0};
+  double m_minimum{std::numeric_limits<double>::infinity()};
+  double m_maximum{-std::numeric_limits<double>::infinity()};
+  LogHistogram m_histogram;
+};
+
+/**
+ * A SummaryRequest turns SIGUSR1 into a flag that the evaluation loop polls
+ * to print its summary while running, similar to cluon::TerminateHandler.
+ */
+class SummaryRequest {
+ private:
+  SummaryRequest(const SummaryRequest &) = delete;
+  SummaryRequest(SummaryRequest &&)      = delete;
+  SummaryRequest &operator=(const SummaryRequest &) = delete;
+  SummaryRequest &operator=(SummaryRequest &&) = delete;
+
+ public:
+  static SummaryRequest &instance() noexcept {
+    static SummaryRequest instance;
+    return instance;
+  }
+
+ public:
+  std::atomic<bool> isRequested{false};
+
+ private:
+  SummaryRequest() noexcept {
+    struct sigaction handler;
+    std::memset(&handler, 0, sizeof(handler));
+    handler.sa_handler = &SummaryRequest::handle;
+    // Interrupted system calls are resumed, e.g., while waiting for a frame.
+    handler.sa_flags = SA_RESTART;
+    ::sigaction(SIGUSR1, &handler, nullptr);
+  }
+
+  static void handle(int) noexcept {
+    instance().isRequested.store(true);
+  }
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYNTHETIC_SOURCE_HPP
+#define SYNTHETIC_SOURCE_HPP
+
+#include "frame-buffer-pool.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace ffe {
+
+/**
+ * A SyntheticSource renders parameterized i420 frames of any size directly
+ * into a FrameBuffer so that end-to-end runs do not need a PNG corpus.
+ */
+class SyntheticSource {
+ public:
+  enum class Pattern : uint8_t {
+    NOISE,    // Uniform noise in all planes; worst case for any encoder.
+    GRADIENT, // Smooth gradients scrolling horizontally.
+    MOVING,   // Checkerboard with a box moving diagonally.
+  };
+
+  /**
+   * @param name Name of the pattern (noise, gradient, moving).
+   * @param pattern Resulting pattern.
+   * @return true if name denotes a known pattern.
+   */
+  static bool parse(const std::string &name, Pattern &pattern) noexcept {
+    if ("noise" == name) {
+      pattern = Pattern::NOISE;
+    } else if ("gradient" == name) {
+      pattern = Pattern::GRADIENT;
+    } else if ("moving" == name) {
+      pattern = Pattern::MOVING;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  explicit SyntheticSource(Pattern pattern) noexcept
+    : m_pattern(pattern) {}
+
+  /**
+   * This method renders the given frame of the sequence.
+   *
+   * @param frame Number of the frame; drives the motion.
+   * @param i420 Destination with the geometry to render.
+   */
+  void render(uint32_t frame, const FrameBuffer &i420) const noexcept {
+    const uint32_t W{i420.width}, H{i420.height};
+    const uint32_t CW{(W + 1) / 2}, CH{(H + 1) / 2};
+    switch (m_pattern) {
+      case Pattern::NOISE: {
+        uint32_t state{0x9e3779b9u * (frame + 1)};
+        for (uint32_t p{0}; p < 3; p++) {
+          const uint32_t PW{(0 == p) ? W : CW}, PH{(0 == p) ? H : CH};
+          for (uint32_t y{0}; y < PH; y++) {
+            uint8_t *row{i420.planes[p] + y * static_cast<uint32_t>(i420.strides[p])};
+            for (uint32_t x{0}; x < PW; x++) {
+              state = state * 1664525u + 1013904223u;
+              row[x] = static_cast<uint8_t>(state >> 24);
+            }
+          }
+        }
+        break;
+      }
+      case Pattern::GRADIENT: {
+        const uint32_t SHIFT{frame * 2};
+        for (uint32_t y{0}; y < H; y++) {
+          uint8_t *row{i420.y() + y * static_cast<uint32_t>(i420.strides[0])};
+          for (uint32_t x{0}; x < W; x++) {
+            row[x] = static_cast<uint8_t>(((x + SHIFT) * 255 / (W + 1)) ^ ((y * 64 / (H + 1)) & 0x0f));
+          }
+        }
+        for (uint32_t y{0}; y < CH; y++) {
+          uint8_t *u{i420.u() + y * static_cast<uint32_t>(i420.strides[1])};
+          uint8_t *v{i420.v() + y * static_cast<uint32_t>(i420.strides[2])};
+          for (uint32_t x{0}; x < CW; x++) {
+            u[x] = static_cast<uint8_t>(64 + (y * 128) / (CH + 1));
+            v[x] = static_cast<uint8_t>(64 + (((x + SHIFT / 2) * 128) / (CW + 1)) % 128);
+          }
+        }
+        break;
+      }
+      case Pattern::MOVING: {
+        constexpr uint32_t TILE{32};
+        const uint32_t BOX{(W < H ? W : H) / 4};
+        const uint32_t BOX_X{(frame * 4) % (W - BOX + 1)};
+        const uint32_t BOX_Y{(frame * 3) % (H - BOX + 1)};
+        for (uint32_t y{0}; y < H; y++) {
+          uint8_t *row{i420.y() + y * static_cast<uint32_t>(i420.strides[0])};
+          const bool INSIDE_Y{(y >= BOX_Y) && (y < BOX_Y + BOX)};
+          for (uint32_t x{0}; x < W; x++) {
+            const bool CHECKER{0 != ((((x + frame) / TILE) ^ (y / TILE)) & 1)};
+            const bool INSIDE{INSIDE_Y && (x >= BOX_X) && (x < BOX_X + BOX)};
+            row[x] = INSIDE ? 235 : (CHECKER ? 180 : 40);
+          }
+        }
+        for (uint32_t y{0}; y < CH; y++) {
+          uint8_t *u{i420.u() + y * static_cast<uint32_t>(i420.strides[1])};
+          uint8_t *v{i420.v() + y * static_cast<uint32_t>(i420.strides[2])};
+          const bool INSIDE_Y{(2 * y >= BOX_Y) && (2 * y < BOX_Y + BOX)};
+          for (uint32_t x{0}; x < CW; x++) {
+            const bool INSIDE{INSIDE_Y && (2 * x >= BOX_X) && (2 * x < BOX_X + BOX)};
+            u[x] = INSIDE ? 90 : 128;
+            v[x] = INSIDE ? 240 : 128;
+          }
+        }
+        break;
+      }
+    }
+  }
+
+ private:
+  Pattern m_pattern{Pattern::MOVING};
+};
+
+} // namespace ffe
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * One complete event (begin and duration) for the Chrome trace-event format.
+ * Names must be string literals as only the pointer is stored.
+ */
+struct TraceEvent {
+  const char *name{nullptr};
+  int64_t begin{0};    // Nanoseconds since the start of the recorder.
+  int64_t duration{0}; // Nanoseconds; -1 marks an instant event.
+  uint32_t frame{0};
+};
+
+/**
+ * Events of one thread. Only the owning thread appends; the number of valid
+ * events is published with release semantics so that the recorder can read
+ * them without taking a lock.
+ */
+class TraceBuffer {
+ private:
+  TraceBuffer(const TraceBuffer &) = delete;
+  TraceBuffer(TraceBuffer &&)      = delete;
+  TraceBuffer &operator=(const TraceBuffer &) = delete;
+  TraceBuffer &operator=(TraceBuffer &&) = delete;
+
+ public:
+  static constexpr std::size_t CHUNK_SIZE{16384};
+
+  TraceBuffer(int64_t tid, const std::string &threadName) noexcept
+    : m_tid(tid)
+    , m_threadName(threadName)
+    , m_chunks() {
+    m_chunks.reserve(64);
+    m_chunks.emplace_back(new TraceEvent[CHUNK_SIZE]);
+  }
+
+  void append(const TraceEvent &event) noexcept {
+    const std::size_t size{m_size.load(std::memory_order_relaxed)};
+    const std::size_t chunk{size / CHUNK_SIZE};
+    if (chunk == m_chunks.size()) {
+      // Only allocation on the recording path; happens every CHUNK_SIZE events.
+      m_chunks.emplace_back(new TraceEvent[CHUNK_SIZE]);
+    }
+    m_chunks[chunk][size % CHUNK_SIZE] = event;
+    m_size.store(size + 1, std::memory_order_release);
+  }
+
+  std::size_t size() const noexcept {
+    return m_size.load(std::memory_order_acquire);
+  }
+
+  const TraceEvent &at(std::size_t i) const noexcept {
+    return m_chunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+  }
+
+  int64_t tid() const noexcept {
+    return m_tid;
+  }
+
+  const std::string &threadName() const noexcept {
+    return m_threadName;
+  }
+
+ private:
+  int64_t m_tid{0};
+  std::string m_threadName;
+  std::vector<std::unique_ptr<TraceEvent[]>> m_chunks;
+  std::atomic<std::size_t> m_size{0};
+};
+
+/**
+ * A TraceRecorder collects begin/end events of the processing stages of
+ * every frame from all threads and writes them in Chrome's trace-event JSON
+ * format (viewable in Perfetto or chrome://tracing) when it is destroyed.
+ */
+class TraceRecorder {
+ private:
+  TraceRecorder(const TraceRecorder &) = delete;
+  TraceRecorder(TraceRecorder &&)      = delete;
+  TraceRecorder &operator=(const TraceRecorder &) = delete;
+  TraceRecorder &operator=(TraceRecorder &&) = delete;
+
+ public:
+  /**
+   * Constructor.
+   *
+   * @param filename File to write the trace to on destruction.
+   */
+  explicit TraceRecorder(const std::string &filename) noexcept
+    : m_filename(filename)
+    , m_buffers() {}
+
+  ~TraceRecorder() noexcept {
+    write();
+  }
+
+  /**
+   * @return Nanoseconds since this recorder was created.
+   */
+  int64_t now() const noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+  }
+
+  /**
+   * This method records a complete event on the calling thread.
+   *
+   * @param name Name of the stage (string literal).
+   * @param frame Number of the frame.
+   * @param begin Begin from now().
+   * @param end End from now().
+   */
+  void complete(const char *name, uint32_t frame, int64_t begin, int64_t end) noexcept {
+    bufferForCurrentThread().append(TraceEvent{name, begin, end - begin, frame});
+  }
+
+  /**
+   * This method records an instant event on the calling thread.
+   */
+  void instant(const char *name, uint32_t frame) noexcept {
+    bufferForCurrentThread().append(TraceEvent{name, now(), -1, frame});
+  }
+
+  /**
+   * This method names the calling thread in the trace; it only takes effect
+   * before the first event is recorded on the thread and is cheap otherwise.
+   */
+  void nameCurrentThread(const std::string &threadName) noexcept {
+    bufferForCurrentThread(threadName);
+  }
+
+  /**
+   * This method writes all events recorded so far; it is called on
+   * destruction, i.e., when all threads that record events have finished.
+   */
+  void write() noexcept {
+    std::lock_guard<std::mutex> lck(m_buffersMutex);
+    if (m_filename.empty() || m_written) {
+      return;
+    }
+    m_written = true;
+
+    std::fstream out(m_filename.c_str(), std::ios::trunc | std::ios::out);
+    if (!out.good()) {
+      return;
+    }
+    const int64_t PID{static_cast<int64_t>(::getpid())};
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first{true};
+    for (const auto &buffer : m_buffers) {
+      out << (first ? "" : ",\n")
+          << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << PID << ",\"tid\":" << buffer->tid()
+          << ",\"args\":{\"name\":\"" << buffer->threadName() << "\"}}";
+      first = false;
+      const std::size_t SIZE{buffer->size()};
+      for (std::size_t i{0}; i < SIZE; i++) {
+        const TraceEvent &e{buffer->at(i)};
+        out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"frame\",\"pid\":" << PID << ",\"tid\":" << buffer->tid()
+            << ",\"ts\":" << e.begin / 1000 << "." << pad3(e.begin % 1000);
+        if (0 > e.duration) {
+          out << ",\"ph\":\"i\",\"s\":\"t\"";
+        } else {
+          out << ",\"ph\":\"X\",\"dur\":" << e.duration / 1000 << "." << pad3(e.duration % 1000);
+        }
+        out << ",\"args\":{\"frame\":" << e.frame << "}}";
+      }
+    }
+    out << "\n]}\n";
+  }
+
+ private:
+  static std::string pad3(int64_t v) noexcept {
+    std::string s{std::to_string(v)};
+    return std::string(3 - s.size(), '0') + s;
+  }
+
+  TraceBuffer &bufferForCurrentThread(const std::string &threadName = "") noexcept {
+    thread_local TraceRecorder *owner{nullptr};
+    thread_local TraceBuffer *buffer{nullptr};
+    if (this != owner) {
+      const int64_t TID{static_cast<int64_t>(::syscall(SYS_gettid))};
+      std::lock_guard<std::mutex> lck(m_buffersMutex);
+      m_buffers.emplace_back(new TraceBuffer{TID, threadName.empty() ? "thread-" + std::to_string(TID) : threadName});
+      buffer = m_buffers.back().get();
+      owner = this;
+    }
+    return *buffer;
+  }
+
+ private:
+  std::string m_filename;
+  std::chrono::steady_clock::time_point m_start{std::chrono::steady_clock::now()};
+  std::mutex m_buffersMutex{};
+  std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+  bool m_written{false};
+};
+
+/**
+ * RAII helper recording the lifetime of a scope as complete event; does
+ * nothing when no recorder is given.
+ */
+class TraceScope {
+ private:
+  TraceScope(const TraceScope &) = delete;
+  TraceScope(TraceScope &&)      = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+  TraceScope &operator=(TraceScope &&) = delete;
+
+ public:
+  TraceScope(TraceRecorder *recorder, const char *name, uint32_t frame) noexcept
+    : m_recorder(recorder)
+    , m_name(name)
+    , m_frame(frame)
+    , m_begin((nullptr != recorder) ? recorder->now() : 0) {}
+
+  ~TraceScope() noexcept {
+    if (nullptr != m_recorder) {
+      m_recorder->complete(m_name, m_frame, m_begin, m_recorder->now());
+    }
+  }
+
+ private:
+  TraceRecorder *m_recorder{nullptr};
+  const char *m_name{nullptr};
+  uint32_t m_frame{0};
+  int64_t m_begin{0};
+};
+
+/**
+ * @return Begin time stamp for traceEnd or 0 when no recorder is given.
+ */
+inline int64_t traceBegin(TraceRecorder *recorder) noexcept {
+  return (nullptr != recorder) ? recorder->now() : 0;
+}
+
+/**
+ * This function records a complete event from begin until now for stages
+ * that do not map to a single scope.
+ */
+inline void traceEnd(TraceRecorder *recorder, const char *name, uint32_t frame, int64_t begin) noexcept {
+  if (nullptr != recorder) {
+    recorder->complete(name, frame, begin, recorder->now());
+  }
+}
+
+} // namespace ffe
+
+#endif
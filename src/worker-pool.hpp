@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2019  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include "cpu-affinity.hpp"
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ffe {
+
+/**
+ * A WorkerPool runs the tasks of a parallel loop on a fixed set of threads
+ * that wait between loops; the calling thread takes part in every loop.
+ */
+class WorkerPool {
+ private:
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool(WorkerPool &&)      = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+  WorkerPool &operator=(WorkerPool &&) = delete;
+
+ public:
+  /**
+   * Constructor.
+   *
+   * @param threads Number of threads including the calling one.
+   * @param placement CPUs and priority of the additional threads.
+   */
+  WorkerPool(uint32_t threads, const ThreadPlacement &placement) noexcept
+    : m_mutex()
+    , m_wakeUp()
+    , m_done()
+    , m_threads()
+    , m_threadIds() {
+    for (uint32_t i{1}; i < threads; i++) {
+      m_threads.emplace_back([this, placement]() {
+        ffe::applyToCurrentThread(placement);
+        {
+          std::lock_guard<std::mutex> lck(m_mutex);
+          m_threadIds.push_back(static_cast<pid_t>(::syscall(SYS_gettid)));
+        }
+        m_done.notify_all();
+        run();
+      });
+    }
+    // The threads are known by their ids once the constructor returns.
+    std::unique_lock<std::mutex> lck(m_mutex);
+    m_done.wait(lck, [this]{ return m_threadIds.size() == m_threads.size(); });
+  }
+
+  ~WorkerPool() noexcept {
+    {
+      std::lock_guard<std::mutex> lck(m_mutex);
+      m_running = false;
+    }
+    m_wakeUp.notify_all();
+    for (auto &t : m_threads) {
+      t.join();
+    }
+  }
+
+  /**
+   * @return Number of threads including the calling one.
+   */
+  uint32_t size() const noexcept {
+    return static_cast<uint32_t>(m_threads.size()) + 1;
+  }
+
+  /**
+   * @return Kernel ids of the additional threads, e.g., to count their events.
+   */
+  const std::vector<pid_t> &threadIds() const noexcept {
+    return m_threadIds;
+  }
+
+  /**
+   * This method calls task for 0 to count - 1 in any order and on any
+   * thread of the pool and returns when all calls returned.
+   *
+   * @param count Number of tasks.
+   * @param task Function to call with the index of a task.
+   */
+  void parallelFor(uint32_t count, const std::function<void(uint32_t)> &task) noexcept {
+    if (m_threads.empty() || (2 > count)) {
+      for (uint32_t i{0}; i < count; i++) {
+        task(i);
+      }
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lck(m_mutex);
+      // Threads that woke up too late for the previous loop are done with it.
+      m_done.wait(lck, [this]{ return 0 == m_active; });
+      m_task = &task;
+      m_count = count;
+      m_next.store(0);
+      m_generation++;
+    }
+    m_wakeUp.notify_all();
+    work(task, count);
+    std::unique_lock<std::mutex> lck(m_mutex);
+    m_done.wait(lck, [this]{ return 0 == m_active; });
+  }
+
+ private:
+  void run() noexcept {
+    uint64_t generation{0};
+    while (true) {
+      const std::function<void(uint32_t)> *task{nullptr};
+      uint32_t count{0};
+      {
+        std::unique_lock<std::mutex> lck(m_mutex);
+        m_wakeUp.wait(lck, [this, &generation]{ return !m_running || (generation != m_generation); });
+        if (!m_running) {
+          return;
+        }
+        generation = m_generation;
+        task = m_task;
+        count = m_count;
+        m_active++;
+      }
+      work(*task, count);
+      {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_active--;
+      }
+      m_done.notify_all();
+    }
+  }
+
+  void work(const std::function<void(uint32_t)> &task, uint32_t count) noexcept {
+    for (uint32_t i{m_next.fetch_add(1)}; i < count; i = m_next.fetch_add(1)) {
+      task(i);
+    }
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  std::condition_variable m_done;
+  bool m_running{true};
+  uint64_t m_generation{0};
+  const std::function<void(uint32_t)> *m_task{nullptr};
+  uint32_t m_count{0};
+  std::atomic<uint32_t> m_next{0};
+  uint32_t m_active{0};
+  std::vector<std::thread> m_threads;
+  std::vector<pid_t> m_threadIds;
+};
+
+} // namespace ffe
+
+#endif